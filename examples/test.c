@@ -0,0 +1,302 @@
+/**
+ * @file test.c
+ * @author Joe Wingbermuehle
+ *
+ * Tests for the embedding interface.  Like test.jl, this prints a dot for
+ * each passing check and FAIL for each failing one.
+ *
+ */
+
+#include "jl.h"
+#include "../src/jl-func.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ASSERT(tst) Assert((tst) != 0, __LINE__)
+
+static int failures = 0;
+
+static void Assert(int tst, int line);
+static char PrintsAs(struct JLContext *context, struct JLValue *value,
+                     const char *expected);
+static void TestBuiltins(void);
+static void TestReleaseBudget(void);
+static void TestMemoryLimit(void);
+static char PrintsToFile(struct JLContext *context, struct JLValue *value,
+                         const char *expected);
+static void TestPrintToFile(void);
+static void *FailingAlloc(void *arg, size_t size);
+static void *FailingRealloc(void *arg, void *ptr,
+                            size_t old_size, size_t new_size);
+static void FailingFree(void *arg, void *ptr, size_t size);
+static void TestAllocatorFailure(void);
+static char DecodesInt(struct JLContext *context, struct JLSchema *schema,
+                       const char *line, int *result);
+static void TestDecodeInt(void);
+
+/** Allocator that fails once its budget of allocations is used up. */
+typedef struct FailingAllocator {
+   size_t budget;          /**< Allocations left before failing. */
+   size_t used;            /**< Bytes currently allocated. */
+} FailingAllocator;
+
+void Assert(int tst, int line)
+{
+   if(tst) {
+      printf(".");
+   } else {
+      printf("\nFAIL (line %d)\n", line);
+      failures += 1;
+   }
+}
+
+char PrintsAs(struct JLContext *context, struct JLValue *value,
+              const char *expected)
+{
+   struct JLBuffer buffer;
+   char result;
+   memset(&buffer, 0, sizeof(buffer));
+   JLPrintToBuffer(context, value, &buffer);
+   result = buffer.data && !strcmp(buffer.data, expected);
+   JLFreeBuffer(context, &buffer);
+   return result;
+}
+
+void TestBuiltins(void)
+{
+   /* Every builtin must have its own slot in the hash table. */
+   const char *name;
+   char found = 1;
+   size_t i;
+   for(i = 0; (name = GetBuiltinName(i)) != NULL; i++) {
+      struct JLValue *value;
+      found = found && FindBuiltin(name, &value);
+   }
+   ASSERT(i > 0);
+   ASSERT(found);
+}
+
+void TestReleaseBudget(void)
+{
+   /* With hash-consing, values waiting to be freed must not be handed
+    * out again when the same expression is parsed. */
+   struct JLContext *context = JLCreateContext();
+   int i;
+   JLSetHashConsing(context, 1);
+   JLSetReleaseBudget(context, 1);
+   for(i = 0; i < 2; i++) {
+      const char *line = "(list 1 (list 2 3) \"x\")";
+      struct JLValue *code = JLParse(context, &line);
+      struct JLValue *result = JLEvaluate(context, code);
+      ASSERT(PrintsAs(context, result, "(1 (2 3) \"x\")"));
+      JLRelease(context, result);
+      JLRelease(context, code);
+   }
+   while(JLCollectStep(context, 1));
+   JLDestroyContext(context);
+}
+
+void TestMemoryLimit(void)
+{
+   /* Allocations over the limit are refused, so usage never exceeds it
+    * and the context is still usable afterwards. */
+   struct JLContext *context = JLCreateContext();
+   const char *line = "(define lst (cons (concat \"abcd\" \"efgh\") lst))";
+   struct JLValue *code = JLParse(context, &line);
+   const size_t limit = JLGetMemoryUsage(context) + 65536;
+   char failed = 0;
+   char within = 1;
+   int i;
+   JLDefineList(context, "lst", 0, NULL);
+   JLSetMemoryLimit(context, limit);
+   for(i = 0; i < 100000 && !failed; i++) {
+      struct JLValue *result = JLEvaluate(context, code);
+      failed = result == NULL;
+      within = within && JLGetMemoryUsage(context) <= limit;
+      JLRelease(context, result);
+   }
+   ASSERT(failed && i > 1);
+   ASSERT(within);
+   JLRelease(context, code);
+
+   JLSetMemoryLimit(context, 0);
+   line = "(concat \"ab\" \"cd\")";
+   code = JLParse(context, &line);
+   {
+      struct JLValue *result = JLEvaluate(context, code);
+      ASSERT(PrintsAs(context, result, "\"abcd\""));
+      JLRelease(context, result);
+   }
+   JLRelease(context, code);
+   JLDestroyContext(context);
+}
+
+char PrintsToFile(struct JLContext *context, struct JLValue *value,
+                  const char *expected)
+{
+   FILE *fd = tmpfile();
+   char temp[256];
+   size_t len;
+   if(fd == NULL) {
+      return 0;
+   }
+   JLPrintToFile(context, value, fd);
+   rewind(fd);
+   len = fread(temp, 1, sizeof(temp) - 1, fd);
+   temp[len] = 0;
+   fclose(fd);
+   return !strcmp(temp, expected);
+}
+
+void TestPrintToFile(void)
+{
+   /* Printing to a file does not allocate from the context, so it works
+    * at the memory limit, even for lists nested deeper than the stack
+    * kept by the printer. */
+   struct JLContext *context = JLCreateContext();
+   const char *line = "(list 1 2 3)";
+   struct JLValue *code = JLParse(context, &line);
+   struct JLValue *result = JLEvaluate(context, code);
+   struct JLValue *deep;
+   char nested[128];
+   int i;
+   for(i = 0; i < 40; i++) {
+      nested[i] = '(';
+      nested[i + 41] = ')';
+   }
+   nested[40] = '1';
+   nested[81] = 0;
+   line = nested;
+   deep = JLParse(context, &line);
+
+   JLSetMemoryLimit(context, JLGetMemoryUsage(context));
+   ASSERT(PrintsToFile(context, result, "(1 2 3)"));
+   ASSERT(PrintsToFile(context, deep, nested));
+   JLSetMemoryLimit(context, 0);
+
+   JLRelease(context, deep);
+   JLRelease(context, result);
+   JLRelease(context, code);
+   JLDestroyContext(context);
+}
+
+void *FailingAlloc(void *arg, size_t size)
+{
+   FailingAllocator *allocator = (FailingAllocator*)arg;
+   void *result;
+   if(allocator->budget == 0) {
+      return NULL;
+   }
+   result = malloc(size);
+   if(result) {
+      allocator->budget -= 1;
+      allocator->used += size;
+   }
+   return result;
+}
+
+void *FailingRealloc(void *arg, void *ptr, size_t old_size, size_t new_size)
+{
+   FailingAllocator *allocator = (FailingAllocator*)arg;
+   void *result;
+   if(allocator->budget == 0) {
+      return NULL;
+   }
+   result = realloc(ptr, new_size);
+   if(result) {
+      allocator->budget -= 1;
+      allocator->used = allocator->used - old_size + new_size;
+   }
+   return result;
+}
+
+void FailingFree(void *arg, void *ptr, size_t size)
+{
+   FailingAllocator *allocator = (FailingAllocator*)arg;
+   allocator->used -= size;
+   free(ptr);
+}
+
+void TestAllocatorFailure(void)
+{
+   /* Fail each allocation in turn.  Evaluation must unwind without
+    * crashing and everything must be freed with the context. */
+   const char *program =
+      "(define f (lambda (x rest) (list x rest (concat \"a\" \"b\"))))"
+      "(f 1 2 3 (substr \"hello\" 1 3) (cons 4 (list 5 6)))";
+   char passed = 0;
+   char freed = 1;
+   size_t n;
+   for(n = 0; n < 1000 && !passed; n++) {
+      FailingAllocator allocator;
+      struct JLContext *context;
+      const char *line = program;
+      struct JLValue *result = NULL;
+      allocator.budget = n;
+      allocator.used = 0;
+      context = JLCreateContextWithAllocator(FailingAlloc, FailingRealloc,
+                                             FailingFree, &allocator);
+      if(context == NULL) {
+         freed = freed && allocator.used == 0;
+         continue;
+      }
+      while(*line) {
+         struct JLValue *code = JLParse(context, &line);
+         JLRelease(context, result);
+         result = JLEvaluate(context, code);
+         JLRelease(context, code);
+         if(code == NULL) {
+            break;
+         }
+      }
+      passed = PrintsAs(context, result, "(1 (2 3 \"ell\" (4 5 6)) \"ab\")");
+      JLRelease(context, result);
+      JLDestroyContext(context);
+      freed = freed && allocator.used == 0;
+   }
+   ASSERT(passed);
+   ASSERT(freed);
+}
+
+char DecodesInt(struct JLContext *context, struct JLSchema *schema,
+                const char *line, int *result)
+{
+   struct JLValue *code = JLParse(context, &line);
+   struct JLValue *value = JLEvaluate(context, code);
+   char decoded = JLDecode(schema, value, result);
+   JLRelease(context, value);
+   JLRelease(context, code);
+   return decoded;
+}
+
+void TestDecodeInt(void)
+{
+   /* Numbers that do not fit in an int are rejected rather than
+    * converted. */
+   struct JLContext *context = JLCreateContext();
+   struct JLField field = { "n", JLFIELD_INT, 0, NULL, 0 };
+   struct JLSchema *schema = JLCreateSchema(context, sizeof(int), 1, &field);
+   int n = 0;
+   ASSERT(DecodesInt(context, schema, "(list (list \"n\" -5.5))", &n));
+   ASSERT(n == -5);
+   ASSERT(!DecodesInt(context, schema, "(list (list \"n\" 1e10))", &n));
+   ASSERT(!DecodesInt(context, schema, "(list (list \"n\" (/ 1 0)))", &n));
+   ASSERT(!DecodesInt(context, schema, "(list (list \"n\" (/ 0 0)))", &n));
+   ASSERT(n == -5);
+   JLDestroySchema(schema);
+   JLDestroyContext(context);
+}
+
+int main(int argc, char *argv[])
+{
+   TestBuiltins();
+   TestReleaseBudget();
+   TestMemoryLimit();
+   TestPrintToFile();
+   TestAllocatorFailure();
+   TestDecodeInt();
+   printf("\ndone\n");
+   return failures ? 1 : 0;
+}
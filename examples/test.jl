@@ -46,6 +46,12 @@
 (define add-five (make-increment 5))
 (assert (= (add-five 2) 7))
 
+; Closures must keep enclosing scopes alive after they return.
+(define add3 (lambda (a) ((lambda (b) (lambda (c) (+ a b c))) 2)))
+(define add-three (add3 1))
+(define pad (list 1 2 3 4 5 6 7 8))
+(assert (= (add-three 3) 6))
+
 (define add (lambda (x y) (+ x y)))
 (define do-define (lambda (x)
    (define add (lambda (y) (- x y)))
@@ -120,5 +126,31 @@
 )
 (assert (= "0123456789,0123456789,0123456789" (repeat "0123456789" 3)))
 
+; Test writing a file through a port and reading it back.
+(define port-file "/tmp/jl-test-port.txt")
+(define out (open-output-file port-file))
+(write-string out "first line\n" "second line\n")
+(write-datum out (list 1 "two"))
+(close-port out)
+(define in (open-input-file port-file))
+(assert (= "first line" (read-line in)))
+(assert (= "second line" (read-line in)))
+(define datum (read-datum in))
+(assert (= 1 (head datum)))
+(assert (= "two" (head (rest datum))))
+(assert (null? (read-line in)))
+(close-port in)
+
+; Test that require evaluates a file only once.
+(define require-file "/tmp/jl-test-require.jl")
+(define require-count 0)
+(define out (open-output-file require-file))
+(write-string out "(define require-count (+ require-count 1))\n"
+                  "(+ require-count 10)\n")
+(close-port out)
+(assert (= 11 (require require-file)))
+(assert (= 11 (require require-file)))
+(assert (= 1 require-count))
+
 (print "\ndone\n")
 
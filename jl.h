@@ -9,6 +9,9 @@
 #ifndef JL_H
 #define JL_H
 
+#include <stddef.h>
+#include <stdio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -24,6 +27,8 @@ extern "C" {
 
 struct JLValue;
 struct JLContext;
+struct JLParser;
+struct JLSchema;
 
 /** The type of special functions.
  * @param context The JL context.
@@ -36,26 +41,239 @@ typedef struct JLValue *(*JLFunction)(struct JLContext *context,
                                       struct JLValue *args,
                                       void *extra);
 
+/** The type of native functions.
+ * Unlike special functions, the arguments are evaluated before the call
+ * and their number and types are checked against the declaration from
+ * JLDefineNative.
+ * @param context The JL context.
+ * @param argc The number of arguments.
+ * @param argv The evaluated arguments (NULL for nil).  These are
+ *             released after the call.
+ * @param extra Extra parameter from JLDefineNative.
+ * @return The result, which should be retained (it will be freed if
+ *         not needed).
+ */
+typedef struct JLValue *(*JLNativeFunction)(struct JLContext *context,
+                                            size_t argc,
+                                            struct JLValue **argv,
+                                            void *extra);
+
+/** Argument types accepted by a native function.
+ * These can be combined.
+ */
+#define JLTYPE_NIL         0x0001   /**< Nil. */
+#define JLTYPE_NUMBER      0x0002   /**< Numbers. */
+#define JLTYPE_STRING      0x0004   /**< Strings. */
+#define JLTYPE_LIST        0x0008   /**< Non-empty lists. */
+#define JLTYPE_LAMBDA      0x0010   /**< Lambdas. */
+#define JLTYPE_USERDATA    0x0100   /**< User data. */
+#define JLTYPE_FUNCTION    0x0220   /**< Special and native functions. */
+#define JLTYPE_ANY         0xFFFF   /**< Anything. */
+
+/** No limit on the number of arguments to a native function. */
+#define JLARGS_UNLIMITED   ((size_t)-1)
+
+/** Memory allocation function.
+ * If this fails, the current evaluation fails with an error.
+ * @param arg The argument from JLCreateContextWithAllocator.
+ * @param size The number of bytes to allocate.
+ * @return The memory (NULL if it could not be allocated).
+ */
+typedef void *(*JLAllocFunction)(void *arg, size_t size);
+
+/** Memory reallocation function.
+ * This is never called with a NULL pointer.
+ * @param arg The argument from JLCreateContextWithAllocator.
+ * @param ptr The memory to resize.
+ * @param old_size The current size of the memory.
+ * @param new_size The new size.
+ * @return The memory (NULL if it could not be allocated).
+ */
+typedef void *(*JLReallocFunction)(void *arg, void *ptr,
+                                   size_t old_size, size_t new_size);
+
+/** Memory release function.
+ * @param arg The argument from JLCreateContextWithAllocator.
+ * @param ptr The memory to release.
+ * @param size The size of the memory.
+ */
+typedef void (*JLFreeFunction)(void *arg, void *ptr, size_t size);
+
+/** Type descriptor for user data values.
+ * The address of the descriptor identifies the type, so a single static
+ * instance should be used for each kind of host object.
+ */
+struct JLUserType {
+
+   /** The name of the type (used when displaying values). */
+   const char *name;
+
+   /** Function called when the last reference to the data is released.
+    * This can be NULL if the data does not need to be cleaned up.
+    * @param context The JL context.
+    * @param data The data from JLDefineUserData.
+    */
+   void (*finalize)(struct JLContext *context, void *data);
+
+};
+
+/** Types of schema fields.
+ * JLFIELD_ARRAY can be combined with the others to collect every entry
+ * for the field into an array.
+ */
+#define JLFIELD_NUMBER     1        /**< double */
+#define JLFIELD_INT        2        /**< int */
+#define JLFIELD_BOOL       3        /**< char set to 0 or 1 */
+#define JLFIELD_STRING     4        /**< const char* into the value */
+#define JLFIELD_RECORD     5        /**< Structure described by a schema. */
+#define JLFIELD_ARRAY      0x10     /**< Array of elements. */
+
+/** Field of a host structure for JLCreateSchema. */
+struct JLField {
+
+   /** The name of the field in the entries. */
+   const char *name;
+
+   /** The JLFIELD_* type. */
+   unsigned int type;
+
+   /** Offset of the field in the structure.
+    * For arrays, this is the offset of a pointer to the elements.
+    */
+   size_t offset;
+
+   /** The schema of records (NULL for other types). */
+   const struct JLSchema *schema;
+
+   /** Offset of the size_t element count for arrays. */
+   size_t count_offset;
+
+};
+
+/** Buffer for output.
+ * All fields must be zero before the buffer is first used.
+ */
+struct JLBuffer {
+   char *data;             /**< The output. */
+   size_t length;          /**< Number of bytes of output. */
+   size_t capacity;        /**< Number of bytes allocated. */
+};
+
 /** Create a context for running JL programs.
- * @return The context.
+ * @return The context (NULL if out of memory).
  */
 JLEXPORT
 struct JLContext *JLCreateContext();
 
+/** Create a context that uses the specified functions for all memory.
+ * The context itself is allocated with these functions, so everything
+ * belonging to the context can be reclaimed together by the allocator.
+ * @param alloc_func The allocation function (NULL for malloc).
+ * @param realloc_func The reallocation function (NULL for realloc).
+ * @param free_func The release function (NULL for free).
+ * @param arg Argument passed to the allocation functions.
+ * @return The context (NULL if out of memory).
+ */
+JLEXPORT
+struct JLContext *JLCreateContextWithAllocator(JLAllocFunction alloc_func,
+                                               JLReallocFunction realloc_func,
+                                               JLFreeFunction free_func,
+                                               void *arg);
+
 /** Destroy a JL context.
  * @param context The context to be destroyed.
  */
 JLEXPORT
 void JLDestroyContext(struct JLContext *context);
 
-/** Create and enter a new lexical scope. */
+/** Save everything reachable from the current scope of a context.
+ * User data and functions defined by the host are saved as nil and must
+ * be defined again after loading.
+ * @param context The context.
+ * @param filename The image file to write.
+ * @return 1 on success, 0 on failure.
+ */
+JLEXPORT
+char JLSaveImage(struct JLContext *context, const char *filename);
+
+/** Create a context from an image written by JLSaveImage.
+ * @param filename The image file to read.
+ * @return The context or NULL if the image could not be loaded.
+ */
 JLEXPORT
-void JLEnterScope(struct JLContext *context);
+struct JLContext *JLLoadImage(const char *filename);
+
+/** Create and enter a new lexical scope.
+ * @param context The context.
+ * @return 1 on success, 0 if out of memory (the scope is unchanged).
+ */
+JLEXPORT
+char JLEnterScope(struct JLContext *context);
 
 /** Leave and destroy the current lexical scope. */
 JLEXPORT
 void JLLeaveScope(struct JLContext *context);
 
+/** Save the current bindings so that they can be restored later.
+ * This enters a new scope to hold everything defined after the
+ * checkpoint.
+ * @param context The context.
+ * @return The mark to pass to JLRollback.
+ */
+JLEXPORT
+size_t JLCheckpoint(struct JLContext *context);
+
+/** Restore the bindings saved by JLCheckpoint.
+ * Everything defined since the checkpoint is released and a new scope
+ * is entered, so the same mark can be used again.  Values retained by
+ * the host remain valid, but names defined after the checkpoint are no
+ * longer visible to them.
+ * @param context The context.
+ * @param mark The mark returned by JLCheckpoint.
+ */
+JLEXPORT
+void JLRollback(struct JLContext *context, size_t mark);
+
+/** Limit the memory used by a context.
+ * This covers all storage for values, bindings, scopes, and strings.
+ * An allocation that would exceed the limit is refused and the current
+ * evaluation fails with an error (memory already in use is not
+ * released).  Functions that create values return NULL in that case.
+ * Temporary storage used to free values is counted but not limited so
+ * that freeing memory cannot fail.
+ * @param context The context.
+ * @param limit The maximum number of bytes (0 for no limit).
+ */
+JLEXPORT
+void JLSetMemoryLimit(struct JLContext *context, size_t limit);
+
+/** Get the memory used by a context.
+ * @param context The context.
+ * @return The number of bytes currently allocated.
+ */
+JLEXPORT
+size_t JLGetMemoryUsage(const struct JLContext *context);
+
+/** Enable or disable hash-consing of parsed expressions.
+ * When enabled, JLParse shares identical literals and structurally
+ * identical subexpressions within the context, reducing the memory
+ * required for large, repetitive inputs.  Values are only shared
+ * with other values parsed while this is enabled.
+ * @param context The context.
+ * @param enable 1 to enable, 0 to disable (the default).
+ */
+JLEXPORT
+void JLSetHashConsing(struct JLContext *context, char enable);
+
+/** Return unused memory to the system.
+ * This collects unreachable reference cycles and releases storage
+ * blocks that no longer contain any live items.  Both also happen
+ * automatically as the context grows; calling this does a full pass.
+ * @param context The context.
+ */
+JLEXPORT
+void JLCompact(struct JLContext *context);
+
 /** Increase the reference count of a value.
  * @param context The context containing the value.
  * @param value The value (can be NULL).
@@ -71,6 +289,25 @@ void JLRetain(struct JLContext *context, struct JLValue *value);
 JLEXPORT
 void JLRelease(struct JLContext *context, struct JLValue *value);
 
+/** Limit the work done by a single release.
+ * By default, releasing the last reference to a structure frees the
+ * whole structure immediately.  With a budget, at most budget values are
+ * freed by each release; the remainder is queued and freed in slices at
+ * the start of later top-level evaluations or by JLCollectStep.
+ * @param context The context.
+ * @param budget The maximum number of values to free (0 for no limit).
+ */
+JLEXPORT
+void JLSetReleaseBudget(struct JLContext *context, size_t budget);
+
+/** Free values queued by JLRelease.
+ * @param context The context.
+ * @param budget The maximum number of values to free (0 for no limit).
+ * @return 1 if more values remain queued, 0 otherwise.
+ */
+JLEXPORT
+char JLCollectStep(struct JLContext *context, size_t budget);
+
 /** Define a value.
  * This will add a binding to the current scope.
  * @param context The context in which to define the value.
@@ -97,18 +334,143 @@ void JLDefineSpecial(struct JLContext *context,
                      JLFunction func,
                      void *extra);
 
+/** Define a native function.
+ * Calls to a native function evaluate the arguments into an array and
+ * fail with an error if the number of arguments is out of range or if
+ * an argument has a type not in type_mask, so func only needs to check
+ * what type_mask cannot express.
+ * This will add the native function to the current scope.
+ * @param context The context in which to define the function.
+ * @param name The name of the function.
+ * @param func The function code.
+ * @param min_args The minimum number of arguments.
+ * @param max_args The maximum number of arguments (JLARGS_UNLIMITED for
+ *                 no limit).
+ * @param type_mask The JLTYPE_* values accepted for every argument.
+ * @param extra Extra parameter to pass to func.
+ */
+JLEXPORT
+void JLDefineNative(struct JLContext *context,
+                    const char *name,
+                    JLNativeFunction func,
+                    size_t min_args,
+                    size_t max_args,
+                    unsigned int type_mask,
+                    void *extra);
+
+/** Report an invalid argument from a native function.
+ * This is for checks that the type mask of the function cannot express.
+ * The error names the function being called.
+ * @param context The context.
+ */
+JLEXPORT
+void JLInvalidArgument(struct JLContext *context);
+
 /** Define a number.
  * This will add a number to the current scope.
  * @param context The context in which to define the number.
  * @param name The name of the binding (NULL for no name).
  * @param value The value to define.
- * @return The value.  This value must be released if not used.
+ * @return The value (NULL if out of memory).  This value must be
+ *         released if not used.
  */
 JLEXPORT
 struct JLValue *JLDefineNumber(struct JLContext *context,
                                const char *name,
                                double value);
 
+/** Define a user data value.
+ * User data values carry an opaque pointer to a host object.
+ * This will add the value to the current scope.
+ * @param context The context in which to define the value.
+ * @param name The name of the binding (NULL for no name).
+ * @param type The type of the data (must be non-NULL).
+ * @param data The host data.  This is finalized if the value cannot be
+ *             created.
+ * @return The value (NULL if out of memory).  This value must be
+ *         released if not used.
+ */
+JLEXPORT
+struct JLValue *JLDefineUserData(struct JLContext *context,
+                                 const char *name,
+                                 const struct JLUserType *type,
+                                 void *data);
+
+/** Define a string.
+ * This will add the string to the current scope.
+ * @param context The context in which to define the string.
+ * @param name The name of the binding (NULL for no name).
+ * @param str The characters of the string (need not be terminated).
+ * @param len The number of characters (there should be no nul
+ *            characters among them).
+ * @return The value (NULL if out of memory).  This value must be
+ *         released if not used.
+ */
+JLEXPORT
+struct JLValue *JLDefineString(struct JLContext *context,
+                               const char *name,
+                               const char *str,
+                               size_t len);
+
+/** Define a string to be filled in by the caller.
+ * This avoids copying strings that are built by the host.  The contents
+ * must be written before the value is used.
+ * This will add the string to the current scope.
+ * @param context The context in which to define the string.
+ * @param name The name of the binding (NULL for no name).
+ * @param len The number of characters.
+ * @param data Set to the storage for the characters.  The terminator
+ *             is already in place.
+ * @return The value (NULL if out of memory).  This value must be
+ *         released if not used.
+ */
+JLEXPORT
+struct JLValue *JLDefineStringBuffer(struct JLContext *context,
+                                     const char *name,
+                                     size_t len,
+                                     char **data);
+
+/** Define a list of values.
+ * The list takes over the references to the items, so they must not be
+ * released by the caller.  Items that have no other references are
+ * linked into the list directly and the rest are copied.
+ * This will add the list to the current scope.
+ * @param context The context in which to define the list.
+ * @param name The name of the binding (NULL for no name).
+ * @param count The number of items.
+ * @param items The items (NULL for nil).
+ * @return The value (NULL if count is 0 or out of memory).  This value
+ *         must be released if not used.
+ */
+JLEXPORT
+struct JLValue *JLDefineList(struct JLContext *context,
+                             const char *name,
+                             size_t count,
+                             struct JLValue **items);
+
+/** Define a list of numbers.
+ * This will add the list to the current scope.
+ * @param context The context in which to define the list.
+ * @param name The name of the binding (NULL for no name).
+ * @param count The number of items.
+ * @param values The numbers.
+ * @return The value (NULL if count is 0 or out of memory).  This value
+ *         must be released if not used.
+ */
+JLEXPORT
+struct JLValue *JLDefineNumberList(struct JLContext *context,
+                                   const char *name,
+                                   size_t count,
+                                   const double *values);
+
+/** Set the maximum nesting of lists accepted by the parser.
+ * Deeper input is rejected with an error.  The default is 65536.
+ * @param context The context.
+ * @param limit The maximum nesting (0 for no limit).
+ */
+JLEXPORT
+void JLSetNestingLimit(struct JLContext *context, size_t limit);
+
 /** Parse an expression.
  * Note that only a single expression is parsed.
  * @param context The context.
@@ -118,6 +480,81 @@ struct JLValue *JLDefineNumber(struct JLContext *context,
 JLEXPORT
 struct JLValue *JLParse(struct JLContext *context, const char **line);
 
+/** Parse an expression from a buffer that need not be terminated.
+ * Note that only a single expression is parsed.
+ * @param context The context.
+ * @param line The expression to be parsed.  This is advanced past the
+ *             parsed expression.
+ * @param len The number of bytes available at line.
+ * @return The expression.  This value must be released if not used.
+ */
+JLEXPORT
+struct JLValue *JLParseN(struct JLContext *context,
+                         const char **line,
+                         size_t len);
+
+/** Parse every expression in a file.
+ * @param context The context.
+ * @param filename The file to parse.
+ * @return A list of the expressions.  This value must be released.
+ */
+JLEXPORT
+struct JLValue *JLParseFile(struct JLContext *context, const char *filename);
+
+/** Parse every expression in a file, using a cache if possible.
+ * The parsed expressions are saved in a cache file next to the source
+ * (the name of the source with "c" appended).  Later calls load the
+ * cache instead of parsing if it matches the contents of the source.
+ * @param context The context.
+ * @param filename The file to parse.
+ * @return A list of the expressions.  This value must be released.
+ */
+JLEXPORT
+struct JLValue *JLParseCachedFile(struct JLContext *context,
+                                  const char *filename);
+
+/** Parse and evaluate every expression in a file.
+ * @param context The context.
+ * @param filename The file to evaluate.
+ * @return The result of the last expression.  This value must be
+ *         released.
+ */
+JLEXPORT
+struct JLValue *JLEvaluateFile(struct JLContext *context,
+                               const char *filename);
+
+/** Create a parser for input that arrives in pieces.
+ * @param context The context.
+ * @return The parser or NULL if out of memory.  This must be destroyed
+ *         with JLDestroyParser.
+ */
+JLEXPORT
+struct JLParser *JLCreateParser(struct JLContext *context);
+
+/** Destroy a parser.
+ * @param parser The parser to destroy.
+ */
+JLEXPORT
+void JLDestroyParser(struct JLParser *parser);
+
+/** Pass input to a parser.
+ * The input is copied, so it need not remain valid after this returns.
+ * @param parser The parser.
+ * @param data The input.
+ * @param len The number of bytes of input (0 at the end of input).
+ * @return 1 on success, 0 if out of memory (the input is dropped).
+ */
+JLEXPORT
+char JLParserFeed(struct JLParser *parser, const char *data, size_t len);
+
+/** Get the next complete expression from a parser.
+ * @param parser The parser.
+ * @return The expression or NULL if more input is needed.  This value
+ *         must be released if not used.
+ */
+JLEXPORT
+struct JLValue *JLParserNext(struct JLParser *parser);
+
 /** Evaluate an expression.
  * @param context The context.
  * @param value The expression to evaluate.
@@ -126,6 +563,20 @@ struct JLValue *JLParse(struct JLContext *context, const char **line);
 JLEXPORT
 struct JLValue *JLEvaluate(struct JLContext *context, struct JLValue *value);
 
+/** Call a lambda with values for its parameters.
+ * The arguments are bound as they are rather than being evaluated.
+ * @param context The context.
+ * @param lambda The lambda to call.
+ * @param argc The number of arguments.
+ * @param argv The arguments (NULL for nil).
+ * @return The result.  This value must be released if not used.
+ */
+JLEXPORT
+struct JLValue *JLCall(struct JLContext *context,
+                       struct JLValue *lambda,
+                       size_t argc,
+                       struct JLValue **argv);
+
 /** Determine if a value is a number.
  * @param value The value to check (NULL is allowed).
  * @return 1 if a number, 0 otherwise.
@@ -175,6 +626,73 @@ struct JLValue *JLGetHead(struct JLValue *value);
 JLEXPORT
 struct JLValue *JLGetNext(struct JLValue *value);
 
+/** Determine if a value is user data of a specific type.
+ * @param value The value to check (NULL is allowed).
+ * @param type The expected type.
+ * @return 1 if user data of the specified type, 0 otherwise.
+ */
+JLEXPORT
+char JLIsUserData(struct JLValue *value, const struct JLUserType *type);
+
+/** Get the data pointer of a user data value.
+ * @param value The value (must be a non-NULL user data value).
+ * @return The data pointer from JLDefineUserData.
+ */
+JLEXPORT
+void *JLGetUserData(struct JLValue *value);
+
+/** Create a schema for decoding values into a host structure.
+ * Decoded values are lists of entries, each a list of the field name
+ * followed by the value, for example (list (list "width" 3)).  Records
+ * take the rest of their entry as their own entries and every entry for
+ * an array field adds an element.
+ * @param context The context.
+ * @param size The size of the structure.
+ * @param count The number of fields.
+ * @param fields The fields.  These are copied, but the names must remain
+ *               valid while the schema is in use.
+ * @return The schema (NULL if the fields are invalid or out of memory).
+ *         This must be released with JLDestroySchema before the context
+ *         is destroyed.
+ */
+JLEXPORT
+struct JLSchema *JLCreateSchema(struct JLContext *context,
+                                size_t size,
+                                size_t count,
+                                const struct JLField *fields);
+
+/** Destroy a schema.
+ * Schemas used for records must be destroyed after the schemas using them.
+ * @param schema The schema to destroy.
+ */
+JLEXPORT
+void JLDestroySchema(struct JLSchema *schema);
+
+/** Decode a value into a host structure.
+ * Fields without entries are left unchanged, so defaults can be set
+ * before decoding.  New array elements start out zeroed.  Strings point
+ * into the value, so the value must be held while they are used.
+ * On error, the path to the field is reported and the structure may be
+ * partly decoded.
+ * @param schema The schema of the structure.
+ * @param value The value to decode (NULL for nil).
+ * @param data The structure.  Arrays must be empty or from an earlier
+ *             decode, in which case new elements are appended.
+ * @return 1 on success, 0 on error.
+ */
+JLEXPORT
+char JLDecode(const struct JLSchema *schema,
+              struct JLValue *value,
+              void *data);
+
+/** Release the arrays allocated by JLDecode.
+ * Arrays are left empty.
+ * @param schema The schema of the structure.
+ * @param data The structure.
+ */
+JLEXPORT
+void JLFreeDecoded(const struct JLSchema *schema, void *data);
+
 /** Display a value.
  * @param context The context.
  * @param value The value to display.
@@ -182,6 +700,38 @@ struct JLValue *JLGetNext(struct JLValue *value);
 JLEXPORT
 void JLPrint(const struct JLContext *context, const struct JLValue *value);
 
+/** Write a value to a file.
+ * The output is collected and written in large pieces.
+ * Printing is not subject to the memory limit.
+ * @param context The context.
+ * @param value The value to display.
+ * @param fd The file to write.
+ */
+JLEXPORT
+void JLPrintToFile(const struct JLContext *context,
+                   const struct JLValue *value,
+                   FILE *fd);
+
+/** Append a value to a buffer.
+ * The buffer is grown as needed and the output is nul terminated.
+ * If out of memory, the output is cut short.
+ * @param context The context.
+ * @param value The value to display.
+ * @param buffer The buffer.  This must be released with JLFreeBuffer.
+ */
+JLEXPORT
+void JLPrintToBuffer(struct JLContext *context,
+                     const struct JLValue *value,
+                     struct JLBuffer *buffer);
+
+/** Release the memory held by a buffer.
+ * The buffer is left empty and can be used again.
+ * @param context The context.
+ * @param buffer The buffer.
+ */
+JLEXPORT
+void JLFreeBuffer(struct JLContext *context, struct JLBuffer *buffer);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
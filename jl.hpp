@@ -0,0 +1,545 @@
+/**
+ * @file jl.hpp
+ * @author Joe Wingbermuehle
+ *
+ * C++ interface to the JL interpreter.
+ *
+ * Values are held by move-only handles, so ownership is passed around
+ * without changing reference counts.  Host functions are bound as native
+ * functions with the argument checks and conversions generated from their
+ * signatures.  This needs C++11; binding functions by template argument
+ * needs C++17.
+ *
+ */
+
+#ifndef JL_HPP
+#define JL_HPP
+
+#include "jl.h"
+
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace jl {
+
+/** A reference to a value.
+ * Handles can be moved but not copied.  Moving a handle transfers its
+ * reference, so only copy() and destroying a handle touch the count.
+ */
+class Value {
+public:
+
+   /** Create an empty handle (nil). */
+   Value() noexcept : context_(nullptr), value_(nullptr) {}
+
+   /** Take over a reference, for example the result of JLEvaluate.
+    * @param context The context of the value.
+    * @param value The value (NULL for nil).
+    */
+   Value(JLContext *context, JLValue *value) noexcept
+      : context_(context), value_(value) {}
+
+   Value(Value &&other) noexcept
+      : context_(other.context_), value_(other.value_)
+   {
+      other.value_ = nullptr;
+   }
+
+   Value &operator=(Value &&other) noexcept
+   {
+      if(this != &other) {
+         reset();
+         context_ = other.context_;
+         value_ = other.value_;
+         other.value_ = nullptr;
+      }
+      return *this;
+   }
+
+   Value(const Value&) = delete;
+   Value &operator=(const Value&) = delete;
+
+   ~Value()
+   {
+      reset();
+   }
+
+   /** Make a handle with a new reference to a value.
+    * @param context The context of the value.
+    * @param value The value (NULL for nil).
+    */
+   static Value retain(JLContext *context, JLValue *value)
+   {
+      JLRetain(context, value);
+      return Value(context, value);
+   }
+
+   /** Make another handle to the same value. */
+   Value copy() const
+   {
+      return retain(context_, value_);
+   }
+
+   /** Release the reference, leaving the handle empty. */
+   void reset() noexcept
+   {
+      if(value_) {
+         JLRelease(context_, value_);
+         value_ = nullptr;
+      }
+   }
+
+   /** Give up the reference without releasing it.
+    * @return The value, which must now be released by the caller.
+    */
+   JLValue *release() noexcept
+   {
+      JLValue *value = value_;
+      value_ = nullptr;
+      return value;
+   }
+
+   /** Get the value without affecting its reference. */
+   JLValue *get() const noexcept { return value_; }
+
+   JLContext *context() const noexcept { return context_; }
+
+   /** Determine if the handle holds a value (not nil). */
+   explicit operator bool() const noexcept { return value_ != nullptr; }
+
+   bool is_number() const { return JLIsNumber(value_) != 0; }
+   bool is_string() const { return JLIsString(value_) != 0; }
+   bool is_list() const { return JLIsList(value_) != 0; }
+
+   /** Get a number (the value must be a number). */
+   double number() const { return JLGetNumber(value_); }
+
+   /** Get a string (the value must be a string).
+    * The string is valid while the value is held.
+    */
+   const char *string() const { return JLGetString(value_); }
+
+private:
+   JLContext *context_;
+   JLValue *value_;
+};
+
+namespace detail {
+
+/** Conversion of native function arguments.
+ * The mask is passed to JLDefineNative.  check() is used when the
+ * arguments do not all have the same mask or when the mask alone is not
+ * enough (exact is false).
+ */
+template<typename T> struct Arg;
+
+template<> struct Arg<double> {
+   static const unsigned int mask = JLTYPE_NUMBER;
+   static const bool exact = true;
+   static bool check(JLValue *v) { return JLIsNumber(v) != 0; }
+   static double get(JLValue *v) { return JLGetNumber(v); }
+};
+
+/** Converting NaN or a number out of range is undefined, so only
+ * numbers that truncate to an int are accepted.
+ */
+template<> struct Arg<int> {
+   static const unsigned int mask = JLTYPE_NUMBER;
+   static const bool exact = false;
+   static bool check(JLValue *v)
+   {
+      /* The comparisons are false for NaN. */
+      return JLIsNumber(v)
+         && JLGetNumber(v) > static_cast<double>(INT_MIN) - 1.0
+         && JLGetNumber(v) < static_cast<double>(INT_MAX) + 1.0;
+   }
+   static int get(JLValue *v) { return (int)JLGetNumber(v); }
+};
+
+template<> struct Arg<bool> {
+   /* 0 and nil are false as in conditions. */
+   static const unsigned int mask = JLTYPE_ANY;
+   static const bool exact = true;
+   static bool check(JLValue *) { return true; }
+   static bool get(JLValue *v)
+   {
+      return v && (!JLIsNumber(v) || JLGetNumber(v) != 0.0);
+   }
+};
+
+template<> struct Arg<const char*> {
+   static const unsigned int mask = JLTYPE_STRING;
+   static const bool exact = true;
+   static bool check(JLValue *v) { return JLIsString(v) != 0; }
+   static const char *get(JLValue *v) { return JLGetString(v); }
+};
+
+template<> struct Arg<std::string> {
+   static const unsigned int mask = JLTYPE_STRING;
+   static const bool exact = true;
+   static bool check(JLValue *v) { return JLIsString(v) != 0; }
+   static std::string get(JLValue *v) { return JLGetString(v); }
+};
+
+/** Values are passed as they are, without a reference. */
+template<> struct Arg<JLValue*> {
+   static const unsigned int mask = JLTYPE_ANY;
+   static const bool exact = true;
+   static bool check(JLValue *) { return true; }
+   static JLValue *get(JLValue *v) { return v; }
+};
+
+template<typename T> struct ArgOf : Arg<typename std::decay<T>::type> {};
+
+/** Conversion of native function results to new references. */
+template<typename R> struct Result;
+
+template<> struct Result<double> {
+   static JLValue *make(JLContext *context, double r)
+   {
+      return JLDefineNumber(context, nullptr, r);
+   }
+};
+
+template<> struct Result<int> {
+   static JLValue *make(JLContext *context, int r)
+   {
+      return JLDefineNumber(context, nullptr, r);
+   }
+};
+
+template<> struct Result<bool> {
+   static JLValue *make(JLContext *context, bool r)
+   {
+      return JLDefineNumber(context, nullptr, r ? 1.0 : 0.0);
+   }
+};
+
+template<> struct Result<const char*> {
+   static JLValue *make(JLContext *context, const char *r)
+   {
+      return r ? JLDefineString(context, nullptr, r, std::strlen(r))
+               : nullptr;
+   }
+};
+
+template<> struct Result<std::string> {
+   static JLValue *make(JLContext *context, const std::string &r)
+   {
+      return JLDefineString(context, nullptr, r.data(), r.size());
+   }
+};
+
+/** The reference held by the handle becomes the result. */
+template<> struct Result<Value> {
+   static JLValue *make(JLContext *, Value &&r)
+   {
+      return r.release();
+   }
+};
+
+/** Returned values must be new references. */
+template<> struct Result<JLValue*> {
+   static JLValue *make(JLContext *, JLValue *r)
+   {
+      return r;
+   }
+};
+
+template<std::size_t... I> struct Indices {};
+
+template<std::size_t N, std::size_t... I>
+struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+
+template<std::size_t... I>
+struct MakeIndices<0, I...> {
+   typedef Indices<I...> type;
+};
+
+/** The union of the argument masks, whether they are all equal and
+ * whether the masks are enough to check the arguments.
+ */
+template<typename... Args> struct Masks {
+   static const unsigned int any = 0;
+   static const bool exact = true;
+   static bool uniform(unsigned int) { return true; }
+};
+
+template<typename T, typename... Rest> struct Masks<T, Rest...> {
+   static const unsigned int any = ArgOf<T>::mask | Masks<Rest...>::any;
+   static const bool exact = ArgOf<T>::exact && Masks<Rest...>::exact;
+   static bool uniform(unsigned int mask)
+   {
+      return ArgOf<T>::mask == mask && Masks<Rest...>::uniform(mask);
+   }
+};
+
+/** Call a function with or without the context as the first argument. */
+template<bool WithContext> struct Caller {
+   template<typename F, typename... A>
+   static auto call(JLContext *, F func, A&&... args)
+      -> decltype(func(std::forward<A>(args)...))
+   {
+      return func(std::forward<A>(args)...);
+   }
+};
+
+template<> struct Caller<true> {
+   template<typename F, typename... A>
+   static auto call(JLContext *context, F func, A&&... args)
+      -> decltype(func(context, std::forward<A>(args)...))
+   {
+      return func(context, std::forward<A>(args)...);
+   }
+};
+
+/** Check and convert the arguments, call the function and convert the
+ * result.  The number of arguments is checked by JLDefineNative.
+ */
+template<typename R, bool WithContext, typename... Args>
+struct Invoke {
+   template<typename F, std::size_t... I>
+   static JLValue *run(JLContext *context, JLValue **argv, F func,
+                       Indices<I...>)
+   {
+      if(!check(argv)) {
+         JLInvalidArgument(context);
+         return nullptr;
+      }
+      return Result<typename std::decay<R>::type>::make(context,
+         Caller<WithContext>::call(context, func,
+                                   ArgOf<Args>::get(argv[I])...));
+   }
+
+   static bool check(JLValue **argv)
+   {
+      typedef Masks<Args...> M;
+      bool valid = true;
+      if(!M::exact || !M::uniform(M::any)) {
+         const bool results[] = { true, ArgOf<Args>::check(*argv++)... };
+         const std::size_t count = sizeof(results) / sizeof(results[0]);
+         for(std::size_t i = 0; i < count; i++) {
+            valid = valid && results[i];
+         }
+      }
+      return valid;
+   }
+};
+
+template<bool WithContext, typename... Args>
+struct Invoke<void, WithContext, Args...> {
+   template<typename F, std::size_t... I>
+   static JLValue *run(JLContext *context, JLValue **argv, F func,
+                       Indices<I...>)
+   {
+      if(!Invoke<int, WithContext, Args...>::check(argv)) {
+         JLInvalidArgument(context);
+         return nullptr;
+      }
+      Caller<WithContext>::call(context, func, ArgOf<Args>::get(argv[I])...);
+      return nullptr;
+   }
+};
+
+template<bool WithContext, typename R, typename... Args> struct Pointer {
+   typedef R (*type)(Args...);
+};
+
+template<typename R, typename... Args> struct Pointer<true, R, Args...> {
+   typedef R (*type)(JLContext*, Args...);
+};
+
+/** Native function calling a function pointer passed as the extra
+ * parameter.
+ */
+template<bool WithContext, typename R, typename... Args>
+JLValue *CallPointer(JLContext *context, std::size_t, JLValue **argv,
+                     void *extra)
+{
+   typedef typename Pointer<WithContext, R, Args...>::type Func;
+   return Invoke<R, WithContext, Args...>::run(context, argv,
+      reinterpret_cast<Func>(extra),
+      typename MakeIndices<sizeof...(Args)>::type());
+}
+
+template<bool WithContext, typename R, typename... Args>
+void DefinePointer(JLContext *context, const char *name,
+                   typename Pointer<WithContext, R, Args...>::type func)
+{
+   const unsigned int mask = Masks<Args...>::any;
+   JLDefineNative(context, name, CallPointer<WithContext, R, Args...>,
+                  sizeof...(Args), sizeof...(Args),
+                  mask ? mask : JLTYPE_ANY,
+                  reinterpret_cast<void*>(func));
+}
+
+#if __cplusplus >= 201703L
+
+/** Native function calling a function known at compile time, which can
+ * be inlined into the glue.
+ */
+template<auto F, bool WithContext, typename R, typename... Args>
+JLValue *CallStatic(JLContext *context, std::size_t, JLValue **argv,
+                    void *)
+{
+   return Invoke<R, WithContext, Args...>::run(context, argv, F,
+      typename MakeIndices<sizeof...(Args)>::type());
+}
+
+template<auto F, bool WithContext, typename R, typename... Args>
+void DefineStatic(JLContext *context, const char *name)
+{
+   const unsigned int mask = Masks<Args...>::any;
+   JLDefineNative(context, name, CallStatic<F, WithContext, R, Args...>,
+                  sizeof...(Args), sizeof...(Args),
+                  mask ? mask : JLTYPE_ANY, nullptr);
+}
+
+template<auto F, typename R, typename... Args>
+void DefineStatic(JLContext *context, const char *name, R (*)(Args...))
+{
+   DefineStatic<F, false, R, Args...>(context, name);
+}
+
+template<auto F, typename R, typename... Args>
+void DefineStatic(JLContext *context, const char *name,
+                  R (*)(JLContext*, Args...))
+{
+   DefineStatic<F, true, R, Args...>(context, name);
+}
+
+#endif
+
+} /* namespace detail */
+
+/** Bind a host function as a native function.
+ * The function can take the context as its first parameter followed by
+ * double, int, bool, const char*, std::string or JLValue* parameters,
+ * which are checked and converted from the arguments.  Strings and
+ * values are only valid during the call.  The result can be void,
+ * double, int, bool, const char*, std::string, Value or a new reference
+ * as a JLValue*.  Functions must not throw.
+ * This will add the function to the current scope.
+ * @param context The context in which to define the function.
+ * @param name The name of the function.
+ * @param func The function.
+ */
+template<typename R, typename... Args>
+void define_function(JLContext *context, const char *name,
+                     R (*func)(Args...))
+{
+   detail::DefinePointer<false, R, Args...>(context, name, func);
+}
+
+template<typename R, typename... Args>
+void define_function(JLContext *context, const char *name,
+                     R (*func)(JLContext*, Args...))
+{
+   detail::DefinePointer<true, R, Args...>(context, name, func);
+}
+
+#if __cplusplus >= 201703L
+
+/** Bind a host function known at compile time as a native function.
+ * This is like define_function, except that the function is called
+ * directly rather than through a pointer.
+ */
+template<auto F>
+void define_function(JLContext *context, const char *name)
+{
+   detail::DefineStatic<F>(context, name, F);
+}
+
+#endif
+
+/** A context that is destroyed with the object.
+ * Values must be released before their context is destroyed.
+ */
+class Context {
+public:
+
+   /** Create a context. */
+   Context() : context_(JLCreateContext()) {}
+
+   /** Take over an existing context. */
+   explicit Context(JLContext *context) noexcept : context_(context) {}
+
+   Context(Context &&other) noexcept : context_(other.context_)
+   {
+      other.context_ = nullptr;
+   }
+
+   Context &operator=(Context &&other) noexcept
+   {
+      if(this != &other) {
+         if(context_) {
+            JLDestroyContext(context_);
+         }
+         context_ = other.context_;
+         other.context_ = nullptr;
+      }
+      return *this;
+   }
+
+   Context(const Context&) = delete;
+   Context &operator=(const Context&) = delete;
+
+   ~Context()
+   {
+      if(context_) {
+         JLDestroyContext(context_);
+      }
+   }
+
+   JLContext *get() const noexcept { return context_; }
+
+   /** Parse the next expression, advancing line past it. */
+   Value parse(const char **line)
+   {
+      return Value(context_, JLParse(context_, line));
+   }
+
+   Value evaluate(const Value &value)
+   {
+      return Value(context_, JLEvaluate(context_, value.get()));
+   }
+
+   Value evaluate_file(const char *filename)
+   {
+      return Value(context_, JLEvaluateFile(context_, filename));
+   }
+
+   /** Call a lambda with values for its parameters. */
+   Value call(const Value &lambda, std::size_t argc, JLValue **argv)
+   {
+      return Value(context_, JLCall(context_, lambda.get(), argc, argv));
+   }
+
+   /** See jl::define_function. */
+   template<typename F>
+   void define_function(const char *name, F func)
+   {
+      jl::define_function(context_, name, func);
+   }
+
+#if __cplusplus >= 201703L
+
+   template<auto F>
+   void define_function(const char *name)
+   {
+      jl::define_function<F>(context_, name);
+   }
+
+#endif
+
+private:
+   JLContext *context_;
+};
+
+} /* namespace jl */
+
+#endif /* JL_HPP */
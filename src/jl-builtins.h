@@ -0,0 +1,30 @@
+/**
+ * @file jl-builtins.h
+ *
+ * Perfect hash table of the builtins in jl-func.c.  This file is
+ * generated by jl-hash: run "make builtins" after adding or renaming
+ * a builtin.
+ *
+ */
+
+#ifndef JL_BUILTINS_H
+#define JL_BUILTINS_H
+
+#include "jl-func.h"
+
+/** Hash seed for which every builtin has its own slot. */
+#define BUILTIN_SEED    0x811d6982u
+
+/** Index + 1 of the builtin in each slot of the hash table. */
+static const unsigned char BUILTIN_TABLE[BUILTIN_SLOTS] = {
+    7,  0,  0,  0,  8,  0, 12,  0,  0, 28,  0,  0,  0, 21,  0, 29,
+    0,  0, 33, 34,  0, 31,  0,  0,  0,  0,  0,  0, 24,  0,  0,  0,
+    0,  0,  0,  0,  2,  0,  0,  0,  0,  0,  5,  0,  0,  6, 22,  0,
+    0,  0,  0,  3,  0,  0, 26, 39,  0,  0,  0,  0, 19,  0,  0,  0,
+   30,  0, 32, 20, 10,  0,  0,  0, 37,  0, 18,  0,  0,  0,  0,  0,
+    0,  0,  0,  0,  0,  0,  0,  0, 40,  0, 35,  0,  0,  0, 25,  0,
+    0,  0,  0,  0, 27,  0,  0,  0,  1,  0,  0,  0,  0,  0,  0, 38,
+    0,  0,  0,  4, 15, 13, 17, 16, 14,  0,  0,  0, 23, 36,  9, 11
+};
+
+#endif /* JL_BUILTINS_H */
@@ -0,0 +1,336 @@
+/**
+ * @file jl-cache.c
+ * @author Joe Wingbermuehle
+ *
+ * Parsed files are saved in a binary form next to the source so that
+ * later loads can skip parsing.  The cache is only used if the hash and
+ * size of the source and the library version match.
+ *
+ * The cache starts with a header followed by each expression in
+ * prefix order: a tag byte, then the number (8 bytes), the length and
+ * bytes of the string, or the number of items in the list.  Lengths and
+ * counts are variable-length integers (7 bits per byte).
+ *
+ */
+
+#include "jl-file.h"
+#include "jl-context.h"
+#include "jl-value.h"
+#include "jl-intern.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+/** Cache file format version. */
+#define CACHE_FORMAT    1
+
+/** Value used to detect files written with a different byte order. */
+#define CACHE_CHECK     0x01020304
+
+/** Header of a cache file. */
+typedef struct CacheHeader {
+   char magic[4];
+   uint8_t format;
+   uint8_t version_major;
+   uint8_t version_minor;
+   uint8_t reserved;
+   uint32_t check;
+   uint32_t reserved2;
+   uint64_t size;          /**< Size of the source. */
+   uint64_t hash;          /**< Hash of the source. */
+} CacheHeader;
+
+/** List being read from a cache. */
+typedef struct CacheFrame {
+   JLValue **tail;
+   size_t remaining;
+} CacheFrame;
+
+static uint64_t HashData(const char *data, size_t size);
+static char *GetCacheName(JLContext *context, const char *filename);
+static void InitHeader(CacheHeader *header, const MappedFile *source);
+static void WriteValue(FileWriter *writer, const JLValue *value);
+static void WriteCache(JLContext *context, const char *filename,
+                       const MappedFile *source, const JLValue *value);
+static JLValue *ReadCache(JLContext *context, const MappedFile *source,
+                          const MappedFile *cache);
+
+uint64_t HashData(const char *data, size_t size)
+{
+   /* 64-bit FNV-1a. */
+   uint64_t hash = 0xcbf29ce484222325ULL;
+   size_t i;
+   for(i = 0; i < size; i++) {
+      hash ^= (unsigned char)data[i];
+      hash *= 0x100000001b3ULL;
+   }
+   return hash;
+}
+
+char *GetCacheName(JLContext *context, const char *filename)
+{
+   const size_t len = strlen(filename);
+   char *result = AllocString(context, len + 2);
+   if(result == NULL) {
+      return NULL;
+   }
+   memcpy(result, filename, len);
+   result[len] = 'c';
+   result[len + 1] = 0;
+   return result;
+}
+
+void InitHeader(CacheHeader *header, const MappedFile *source)
+{
+   memset(header, 0, sizeof(CacheHeader));
+   memcpy(header->magic, "JLC", 4);
+   header->format = CACHE_FORMAT;
+   header->version_major = JL_VERSION_MAJOR;
+   header->version_minor = JL_VERSION_MINOR;
+   header->check = CACHE_CHECK;
+   header->size = source->size;
+   header->hash = HashData(source->data, source->size);
+}
+
+void WriteValue(FileWriter *writer, const JLValue *value)
+{
+   /* Lists are written with an explicit stack holding the item being
+    * written in each open list. */
+   JLContext *context = writer->context;
+   const JLValue **stack = NULL;
+   size_t depth = 0;
+   size_t max_depth = 0;
+
+   for(;;) {
+      const char tag = value ? value->tag : JLVALUE_NIL;
+      const JLValue *item;
+      size_t count = 0;
+      WriteData(writer, &tag, 1);
+      switch(tag) {
+      case JLVALUE_NUMBER:
+         WriteData(writer, &value->value.number, sizeof(double));
+         break;
+      case JLVALUE_STRING:
+      case JLVALUE_VARIABLE:
+         count = strlen(value->value.str);
+         WriteLength(writer, count);
+         WriteData(writer, value->value.str, count);
+         break;
+      case JLVALUE_LIST:
+         for(item = value->value.lst; item; item = item->next) {
+            count += 1;
+         }
+         WriteLength(writer, count);
+         if(count > 0) {
+            if(depth == max_depth) {
+               const size_t new_depth = max_depth ? max_depth * 2 : 16;
+               const JLValue **temp = (const JLValue**)ReallocMemory(
+                                          context, stack,
+                                          max_depth * sizeof(JLValue*),
+                                          new_depth * sizeof(JLValue*));
+               if(temp == NULL) {
+                  writer->failed = 1;
+                  break;
+               }
+               stack = temp;
+               max_depth = new_depth;
+            }
+            stack[depth++] = value->value.lst;
+            value = value->value.lst;
+            continue;
+         }
+         break;
+      default:
+         break;
+      }
+      if(writer->failed) {
+         break;
+      }
+
+      /* Move to the next item, closing finished lists. */
+      while(depth > 0 && stack[depth - 1]->next == NULL) {
+         depth -= 1;
+      }
+      if(depth == 0) {
+         break;
+      }
+      stack[depth - 1] = stack[depth - 1]->next;
+      value = stack[depth - 1];
+   }
+   FreeMemory(context, stack, max_depth * sizeof(JLValue*));
+}
+
+void WriteCache(JLContext *context, const char *filename,
+                const MappedFile *source, const JLValue *value)
+{
+   FileWriter writer;
+   CacheHeader header;
+   char *cache_name = GetCacheName(context, filename);
+   if(cache_name == NULL) {
+      return;
+   }
+   InitWriter(&writer, context);
+   InitHeader(&header, source);
+   WriteData(&writer, &header, sizeof(header));
+   WriteValue(&writer, value);
+   SaveWriter(&writer, cache_name);
+   FreeString(context, cache_name);
+}
+
+JLValue *ReadCache(JLContext *context, const MappedFile *source,
+                   const MappedFile *cache)
+{
+   /* Lists are read with an explicit stack holding the end of each open
+    * list and the number of items left to read.  The file contains a
+    * single list of every expression.  Returns NULL if the cache is
+    * stale or damaged. */
+   const char *data = cache->data + sizeof(CacheHeader);
+   const char *end = cache->data + cache->size;
+   CacheHeader header;
+   CacheHeader expected;
+   CacheFrame *stack = NULL;
+   size_t depth = 0;
+   size_t max_depth = 0;
+   JLValue *root = NULL;
+   JLValue **tail = &root;
+   char failed = 0;
+
+   if(cache->size < sizeof(CacheHeader)) {
+      return NULL;
+   }
+   memcpy(&header, cache->data, sizeof(CacheHeader));
+   InitHeader(&expected, source);
+   if(memcmp(&header, &expected, sizeof(CacheHeader))) {
+      return NULL;
+   }
+
+   do {
+      JLValue *value;
+      char tag;
+      size_t len;
+
+      if(data >= end) {
+         failed = 1;
+         break;
+      }
+      tag = *data++;
+      value = CreateValue(context, NULL, JLVALUE_NIL);
+      if(value == NULL) {
+         failed = 1;
+         break;
+      }
+      *tail = value;
+      tail = &value->next;
+      if(depth > 0) {
+         stack[depth - 1].tail = tail;
+         stack[depth - 1].remaining -= 1;
+      }
+
+      switch(tag) {
+      case JLVALUE_NIL:
+         break;
+      case JLVALUE_NUMBER:
+         if(end - data < (ptrdiff_t)sizeof(double)) {
+            failed = 1;
+            break;
+         }
+         value->tag = JLVALUE_NUMBER;
+         memcpy(&value->value.number, data, sizeof(double));
+         data += sizeof(double);
+         break;
+      case JLVALUE_STRING:
+      case JLVALUE_VARIABLE:
+         if(!ReadLength(&data, end, &len) || len > (size_t)(end - data)) {
+            failed = 1;
+            break;
+         }
+         value->value.str = AllocString(context, len + 1);
+         if(value->value.str == NULL) {
+            failed = 1;
+            break;
+         }
+         value->tag = tag;
+         memcpy(value->value.str, data, len);
+         value->value.str[len] = 0;
+         data += len;
+         break;
+      case JLVALUE_LIST:
+         if(!ReadLength(&data, end, &len) || len > (size_t)(end - data)) {
+            failed = 1;
+            break;
+         }
+         value->tag = JLVALUE_LIST;
+         if(len > 0) {
+            if(depth == max_depth) {
+               const size_t new_depth = max_depth ? max_depth * 2 : 16;
+               CacheFrame *temp = (CacheFrame*)ReallocMemory(context, stack,
+                                       max_depth * sizeof(CacheFrame),
+                                       new_depth * sizeof(CacheFrame));
+               if(temp == NULL) {
+                  failed = 1;
+                  break;
+               }
+               stack = temp;
+               max_depth = new_depth;
+            }
+            tail = &value->value.lst;
+            stack[depth].tail = tail;
+            stack[depth].remaining = len;
+            depth += 1;
+         }
+         break;
+      default:
+         failed = 1;
+         break;
+      }
+
+      /* Close finished lists. */
+      while(!failed && depth > 0 && stack[depth - 1].remaining == 0) {
+         depth -= 1;
+         if(depth > 0) {
+            tail = stack[depth - 1].tail;
+         }
+      }
+   } while(!failed && depth > 0);
+
+   FreeMemory(context, stack, max_depth * sizeof(CacheFrame));
+   if(failed || data != end || root == NULL || root->tag != JLVALUE_LIST) {
+      JLRelease(context, root);
+      return NULL;
+   }
+   if(context->hash_cons) {
+      root = InternTree(context, root);
+   }
+   return root;
+}
+
+JLValue *JLParseCachedFile(JLContext *context, const char *filename)
+{
+   JLValue *result = NULL;
+   MappedFile source;
+   MappedFile cache;
+   char *cache_name;
+   char failed;
+
+   if(!MapFile(context, filename, &source)) {
+      Error(context, "could not open %s", filename);
+      return NULL;
+   }
+
+   cache_name = GetCacheName(context, filename);
+   if(cache_name && MapFile(context, cache_name, &cache)) {
+      result = ReadCache(context, &source, &cache);
+      UnmapFile(context, &cache);
+   }
+   FreeString(context, cache_name);
+
+   if(result == NULL) {
+      result = ParseData(context, source.data, source.size, &failed);
+      if(!failed) {
+         WriteCache(context, filename, &source, result);
+      }
+   }
+   UnmapFile(context, &source);
+   return result;
+}
@@ -7,62 +7,495 @@
 #include "jl-context.h"
 #include "jl-scope.h"
 #include "jl-value.h"
+#include "jl-intern.h"
+#include "jl-gc.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
-
-#define BLOCK_SIZE   8192
+#include <stdint.h>
+#include <string.h>
 
 typedef struct FreeNode {
-   union {
-      BindingNode        binding;
-      ScopeNode          scope;
-      JLValue            value;
-      struct FreeNode   *next;
-   };
+   struct FreeNode *next;
 } FreeNode;
 
+/** Items allocated from BLOCK_NODE blocks. */
+typedef union NodeItem {
+   SpecialFunction   special;
+   NativeFunction    native;
+   UserData          user;
+   InternNode        intern;
+} NodeItem;
+
+/** Block header; item_count items follow. */
 typedef struct BlockNode {
-   FreeNode nodes[BLOCK_SIZE];
    struct BlockNode *next;
+   size_t item_count;
+   FreeNode *freelist;     /**< Free items (only used while trimming). */
+   size_t free_count;      /**< Number of free items (while trimming). */
 } BlockNode;
 
-void *GetFree(JLContext *context)
+static const size_t ITEM_SIZES[BLOCK_TYPES] = {
+   sizeof(JLValue),
+   sizeof(BindingNode),
+   sizeof(ScopeNode),
+   sizeof(NodeItem)
+};
+
+static void *DefaultAlloc(void *arg, size_t size);
+static void *DefaultRealloc(void *arg, void *ptr,
+                            size_t old_size, size_t new_size);
+static void DefaultFree(void *arg, void *ptr, size_t size);
+static char CheckLimit(JLContext *context, size_t old_size, size_t new_size);
+static void *CheckMemory(JLContext *context, void *ptr, size_t size);
+static char NewBlock(JLContext *context, BlockType type);
+static int CompareBlocks(const void *a, const void *b);
+static BlockNode *FindBlock(BlockNode **blocks, size_t count,
+                            const void *item);
+static void TrimBlocks(JLContext *context, BlockType type);
+
+void *DefaultAlloc(void *arg, size_t size)
 {
-   FreeNode *node;
-   if(context->freelist == NULL) {
-      BlockNode *block = (BlockNode*)malloc(sizeof(BlockNode));
-      size_t i;
-      block->next = context->blocks;
-      context->blocks = block;
-      for(i = 1; i < BLOCK_SIZE; i++) {
-         block->nodes[i].next = context->freelist;
-         context->freelist = &block->nodes[i];
+   return malloc(size);
+}
+
+void *DefaultRealloc(void *arg, void *ptr, size_t old_size, size_t new_size)
+{
+   return realloc(ptr, new_size);
+}
+
+void DefaultFree(void *arg, void *ptr, size_t size)
+{
+   free(ptr);
+}
+
+char CheckLimit(JLContext *context, size_t old_size, size_t new_size)
+{
+   /* Allocations that would exceed the limit are refused.  The error is
+    * only reported once so that unwinding does not repeat it. */
+   if(context->memory_limit > 0 && new_size > old_size &&
+      context->memory_used - old_size + new_size > context->memory_limit) {
+      if(!context->error) {
+         Error(context, "memory limit exceeded");
+      }
+      return 0;
+   }
+   return 1;
+}
+
+void *CheckMemory(JLContext *context, void *ptr, size_t size)
+{
+   /* Failures are passed to the caller, which unwinds the evaluation. */
+   if(ptr == NULL && size > 0 && !context->error) {
+      Error(context, "out of memory");
+   }
+   return ptr;
+}
+
+void *AllocMemory(JLContext *context, size_t size)
+{
+   if(!CheckLimit(context, 0, size)) {
+      return NULL;
+   }
+   return CheckMemory(context, AllocInternal(context, size), size);
+}
+
+void *ReallocMemory(JLContext *context, void *ptr,
+                    size_t old_size, size_t new_size)
+{
+   if(!CheckLimit(context, ptr ? old_size : 0, new_size)) {
+      return NULL;
+   }
+   return CheckMemory(context,
+                      ReallocInternal(context, ptr, old_size, new_size),
+                      new_size);
+}
+
+void *AllocInternal(JLContext *context, size_t size)
+{
+   /* Bookkeeping, such as the storage needed to release values, is
+    * counted but not limited, so freeing memory cannot fail the limit.
+    * Returns NULL without reporting an error if out of memory. */
+   void *result = (context->alloc_func)(context->alloc_arg, size);
+   if(result) {
+      context->memory_used += size;
+   }
+   return result;
+}
+
+void *ReallocInternal(JLContext *context, void *ptr,
+                      size_t old_size, size_t new_size)
+{
+   /* The original memory is kept if this fails. */
+   void *result;
+   if(ptr == NULL) {
+      return AllocInternal(context, new_size);
+   }
+   result = (context->realloc_func)(context->alloc_arg, ptr,
+                                    old_size, new_size);
+   if(result) {
+      context->memory_used = context->memory_used - old_size + new_size;
+   }
+   return result;
+}
+
+void FreeMemory(JLContext *context, void *ptr, size_t size)
+{
+   if(ptr) {
+      context->memory_used -= size;
+      (context->free_func)(context->alloc_arg, ptr, size);
+   }
+}
+
+char *AllocString(JLContext *context, size_t size)
+{
+   /* Strings are preceded by their allocated size for accounting. */
+   size_t *result = (size_t*)AllocMemory(context, sizeof(size_t) + size);
+   if(result == NULL) {
+      return NULL;
+   }
+   result[0] = size;
+   return (char*)&result[1];
+}
+
+char *ReallocString(JLContext *context, char *str, size_t size)
+{
+   size_t *result = (size_t*)str - 1;
+   result = (size_t*)ReallocMemory(context, result,
+                                   sizeof(size_t) + result[0],
+                                   sizeof(size_t) + size);
+   if(result == NULL) {
+      return NULL;
+   }
+   result[0] = size;
+   return (char*)&result[1];
+}
+
+char *CopyString(JLContext *context, const char *str)
+{
+   const size_t size = strlen(str) + 1;
+   char *result = AllocString(context, size);
+   if(result) {
+      memcpy(result, str, size);
+   }
+   return result;
+}
+
+void FreeString(JLContext *context, char *str)
+{
+   if(str) {
+      size_t *temp = (size_t*)str - 1;
+      FreeMemory(context, temp, sizeof(size_t) + temp[0]);
+   }
+}
+
+void JLSetMemoryLimit(JLContext *context, size_t limit)
+{
+   context->memory_limit = limit;
+}
+
+size_t JLGetMemoryUsage(const JLContext *context)
+{
+   return context->memory_used;
+}
+
+void *GetFree(JLContext *context, BlockType type)
+{
+   SlabNode *slab = &context->slabs[type];
+   FreeNode *node = slab->freelist;
+
+   /* Reuse a freed item if possible. */
+   if(node) {
+      slab->freelist = node->next;
+      slab->free_count -= 1;
+      return node;
+   }
+
+   /* Otherwise carve the next item from the newest block. */
+   if(slab->next_item == slab->end_item) {
+      if((type == BLOCK_VALUE || type == BLOCK_SCOPE) &&
+         context->slabs[BLOCK_VALUE].item_count
+         + context->slabs[BLOCK_SCOPE].item_count >= context->gc_items) {
+         /* Look for cycles before growing the heap. */
+         CollectCycles(context);
+         if(slab->freelist) {
+            return GetFree(context, type);
+         }
+      }
+      if(!NewBlock(context, type)) {
+         return NULL;
       }
-      node = &block->nodes[0];
-   } else {
-      node = context->freelist;
-      context->freelist = node->next;
    }
+   node = (FreeNode*)slab->next_item;
+   slab->next_item += ITEM_SIZES[type];
+   slab->free_count -= 1;
    return node;
 }
 
-void PutFree(JLContext *context, void *value)
+char NewBlock(JLContext *context, BlockType type)
+{
+   /* Items are zeroed so that unused items have a zero count.
+    * Items are not put on the free list; GetFree hands them out in
+    * order, so a fresh block is only touched as it is used. */
+   SlabNode *slab = &context->slabs[type];
+   size_t item_count = slab->item_count;
+   size_t block_size;
+   BlockNode *block;
+
+   if(item_count < MIN_BLOCK_SIZE) {
+      item_count = MIN_BLOCK_SIZE;
+   } else if(item_count > BLOCK_SIZE) {
+      item_count = BLOCK_SIZE;
+   }
+   block_size = ITEM_SIZES[type] * item_count;
+   block = (BlockNode*)AllocMemory(context, sizeof(BlockNode) + block_size);
+   if(block == NULL) {
+      return 0;
+   }
+   memset(block, 0, sizeof(BlockNode) + block_size);
+   block->next = slab->blocks;
+   block->item_count = item_count;
+   slab->blocks = block;
+   slab->block_count += 1;
+   slab->item_count += item_count;
+   slab->free_count += item_count;
+   slab->next_item = (char*)(block + 1);
+   slab->end_item = slab->next_item + block_size;
+   return 1;
+}
+
+void ForEachItem(JLContext *context, BlockType type,
+                 ItemFunction func, void *arg)
 {
+   const size_t item_size = ITEM_SIZES[type];
+   BlockNode *block;
+   for(block = context->slabs[type].blocks; block; block = block->next) {
+      char *items = (char*)(block + 1);
+      size_t i;
+      for(i = 0; i < block->item_count; i++) {
+         (func)(context, &items[i * item_size], arg);
+      }
+   }
+}
+
+void PutFree(JLContext *context, BlockType type, void *value)
+{
+   SlabNode *slab = &context->slabs[type];
    FreeNode *temp = (FreeNode*)value;
-   temp->next = context->freelist;
-   context->freelist = temp;
+   temp->next = slab->freelist;
+   slab->freelist = temp;
+   slab->free_count += 1;
+}
+
+int CompareBlocks(const void *a, const void *b)
+{
+   const uintptr_t ia = (uintptr_t)*(BlockNode* const*)a;
+   const uintptr_t ib = (uintptr_t)*(BlockNode* const*)b;
+   return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+BlockNode *FindBlock(BlockNode **blocks, size_t count, const void *item)
+{
+   /* Find the last block starting at or before the item. */
+   const uintptr_t addr = (uintptr_t)item;
+   size_t low = 0;
+   size_t high = count;
+   while(high - low > 1) {
+      const size_t mid = (low + high) / 2;
+      if((uintptr_t)blocks[mid] <= addr) {
+         low = mid;
+      } else {
+         high = mid;
+      }
+   }
+   return blocks[low];
+}
+
+void TrimBlocks(JLContext *context, BlockType type)
+{
+   SlabNode *slab = &context->slabs[type];
+   BlockNode **blocks;
+   BlockNode *block;
+   BlockNode *carve_block = NULL;
+   FreeNode *node;
+   size_t count = 0;
+   size_t i;
+
+   if(slab->block_count == 0) {
+      return;
+   }
+
+   /* Sort the blocks by address so that items can be mapped back to the
+    * block containing them. */
+   blocks = (BlockNode**)AllocInternal(context,
+                                       sizeof(BlockNode*) * slab->block_count);
+   if(blocks == NULL) {
+      /* Nothing is trimmed if there is no memory for the table. */
+      return;
+   }
+   for(block = slab->blocks; block; block = block->next) {
+      block->freelist = NULL;
+      block->free_count = 0;
+      blocks[count++] = block;
+   }
+   qsort(blocks, count, sizeof(BlockNode*), CompareBlocks);
+
+   /* Distribute the free items to their blocks.  Items not yet carved
+    * from the newest block count as free. */
+   if(slab->next_item != slab->end_item) {
+      carve_block = FindBlock(blocks, count, slab->next_item);
+      carve_block->free_count = (slab->end_item - slab->next_item)
+                              / ITEM_SIZES[type];
+   }
+   node = slab->freelist;
+   while(node) {
+      FreeNode *next = node->next;
+      block = FindBlock(blocks, count, node);
+      node->next = block->freelist;
+      block->freelist = node;
+      block->free_count += 1;
+      node = next;
+   }
+
+   /* Release empty blocks and rebuild the free list so that items from
+    * the same block are handed out together. */
+   slab->freelist = NULL;
+   slab->blocks = NULL;
+   slab->block_count = 0;
+   slab->item_count = 0;
+   slab->free_count = 0;
+   for(i = 0; i < count; i++) {
+      block = blocks[i];
+      if(block->free_count == block->item_count) {
+         if(block == carve_block) {
+            slab->next_item = NULL;
+            slab->end_item = NULL;
+         }
+         FreeMemory(context, block, sizeof(BlockNode)
+                    + ITEM_SIZES[type] * block->item_count);
+         continue;
+      }
+      node = block->freelist;
+      while(node) {
+         FreeNode *next = node->next;
+         node->next = slab->freelist;
+         slab->freelist = node;
+         node = next;
+      }
+      block->next = slab->blocks;
+      slab->blocks = block;
+      slab->block_count += 1;
+      slab->item_count += block->item_count;
+      slab->free_count += block->free_count;
+   }
+   slab->trim_free = slab->free_count;
+   FreeMemory(context, blocks, sizeof(BlockNode*) * count);
+}
+
+void ReclaimBlocks(JLContext *context, char all)
+{
+   BlockType type;
+   for(type = 0; type < BLOCK_TYPES; type++) {
+      const SlabNode *slab = &context->slabs[type];
+      /* Only trim automatically when at least half of the storage and
+       * several blocks worth of items are unused.  Items left free by the
+       * last trim could not be released, so another trim waits until
+       * enough items have been freed since then to make a difference. */
+      if(all || (slab->free_count >= 4 * BLOCK_SIZE &&
+                 slab->free_count * 2 >= slab->item_count &&
+                 slab->free_count >= slab->trim_free
+                                     + slab->item_count / 8)) {
+         TrimBlocks(context, type);
+      }
+   }
+}
+
+void JLCompact(JLContext *context)
+{
+   ProcessReleases(context, 0);
+   CollectCycles(context);
+   ReclaimBlocks(context, 1);
+}
+
+JLContext *AllocContext(JLAllocFunction alloc_func,
+                        JLReallocFunction realloc_func,
+                        JLFreeFunction free_func,
+                        void *arg)
+{
+   JLContext *context;
+   BlockType type;
+   alloc_func = alloc_func ? alloc_func : DefaultAlloc;
+   context = (JLContext*)(alloc_func)(arg, sizeof(JLContext));
+   if(context == NULL) {
+      return NULL;
+   }
+   context->alloc_func = alloc_func;
+   context->realloc_func = realloc_func ? realloc_func : DefaultRealloc;
+   context->free_func = free_func ? free_func : DefaultFree;
+   context->alloc_arg = arg;
+   context->memory_used = sizeof(JLContext);
+   context->memory_limit = 0;
+   context->scope = NULL;
+   context->modules = NULL;
+   context->module = NULL;
+   context->native_name = NULL;
+   for(type = 0; type < BLOCK_TYPES; type++) {
+      context->slabs[type].freelist = NULL;
+      context->slabs[type].blocks = NULL;
+      context->slabs[type].next_item = NULL;
+      context->slabs[type].end_item = NULL;
+      context->slabs[type].block_count = 0;
+      context->slabs[type].item_count = 0;
+      context->slabs[type].free_count = 0;
+      context->slabs[type].trim_free = 0;
+   }
+   context->intern_table = NULL;
+   context->intern_size = 0;
+   context->intern_count = 0;
+   context->line = 1;
+   context->parse_end = NULL;
+   context->levels = 0;
+   context->max_levels = 1 << 15;
+   context->max_nesting = 1 << 16;
+   context->parse_stack = NULL;
+   context->parse_stack_size = 0;
+   context->error = 0;
+   context->hash_cons = 0;
+   context->collecting = 0;
+   context->gc_items = 0;
+   context->numbers = NULL;
+   context->releases = NULL;
+   context->release_count = 0;
+   context->release_max = 0;
+   context->release_budget = 0;
+   context->releasing = 0;
+   return context;
 }
 
 void FreeContext(JLContext *context)
 {
-   while(context->blocks) {
-      BlockNode *next = context->blocks->next;
-      free(context->blocks);
-      context->blocks = next;
+   BlockType type;
+   for(type = 0; type < BLOCK_TYPES; type++) {
+      SlabNode *slab = &context->slabs[type];
+      while(slab->blocks) {
+         BlockNode *next = slab->blocks->next;
+         FreeMemory(context, slab->blocks, sizeof(BlockNode)
+                    + ITEM_SIZES[type] * slab->blocks->item_count);
+         slab->blocks = next;
+      }
+   }
+   FreeMemory(context, context->intern_table,
+              context->intern_size * sizeof(struct InternNode*));
+   FreeMemory(context, context->parse_stack,
+              context->parse_stack_size * sizeof(JLValue**));
+   FreeMemory(context, context->releases,
+              context->release_max * sizeof(JLValue*));
+   if(context->numbers) {
+      FreeMemory(context, context->numbers,
+                 SMALL_NUMBER_COUNT * sizeof(JLValue*));
    }
-   free(context);
+   (context->free_func)(context->alloc_arg, context, sizeof(JLContext));
 }
 
 void Error(JLContext *context, const char *msg, ...)
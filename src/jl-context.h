@@ -6,23 +6,126 @@
 #ifndef JL_CONTEXT_H
 #define JL_CONTEXT_H
 
+#include "jl.h"
+
+#include <stddef.h>
+
 struct ScopeNode;
 struct FreeNode;
 struct BlockNode;
+struct InternNode;
+struct JLValue;
+struct ModuleNode;
 
-typedef struct JLContext {
-   struct ScopeNode *scope;
+/** Number of small integers shared by JLDefineNumber. */
+#define SMALL_NUMBER_COUNT 256
+
+/** Number of items in the first block of each kind.
+ * Later blocks double the number of items up to BLOCK_SIZE, so small
+ * contexts stay small.
+ */
+#define MIN_BLOCK_SIZE  8
+
+/** Maximum number of items in each block. */
+#define BLOCK_SIZE      1024
+
+/** Kinds of allocations.
+ * Each kind is allocated from its own blocks so that items are sized
+ * exactly and related items stay together.
+ */
+typedef unsigned char BlockType;
+#define BLOCK_VALUE     0     /**< Values. */
+#define BLOCK_BINDING   1     /**< Bindings. */
+#define BLOCK_SCOPE     2     /**< Scopes. */
+#define BLOCK_NODE      3     /**< Other out-of-line payloads. */
+#define BLOCK_TYPES     4
+
+/** Blocks and free items of one kind. */
+typedef struct SlabNode {
    struct FreeNode *freelist;
    struct BlockNode *blocks;
+   char *next_item;        /**< Next unused item in the newest block. */
+   char *end_item;         /**< End of the newest block. */
+   size_t block_count;
+   size_t item_count;      /**< Number of items in all blocks. */
+   size_t free_count;
+   size_t trim_free;       /**< Free items left by the last trim. */
+} SlabNode;
+
+typedef struct JLContext {
+   struct ScopeNode *scope;
+   struct ModuleNode *modules;   /**< Files loaded by include or require. */
+   struct ModuleNode *module;    /**< File being evaluated. */
+   const char *native_name;      /**< Native function being called. */
+   SlabNode slabs[BLOCK_TYPES];
+   struct InternNode **intern_table;
+   size_t intern_size;
+   size_t intern_count;
+   const char *parse_end;  /**< End of the input (NULL if terminated). */
    unsigned int line;
    unsigned int levels;
    unsigned int max_levels;
+   size_t max_nesting;     /**< Maximum list nesting when parsing. */
+   struct JLValue ***parse_stack;
+   size_t parse_stack_size;
+   size_t gc_items;        /**< Heap size for the next collection. */
+   struct JLValue **numbers;
+   struct JLValue **releases;
+   size_t release_count;
+   size_t release_max;
+   size_t release_budget;
+   size_t memory_used;
+   size_t memory_limit;
+   JLAllocFunction alloc_func;
+   JLReallocFunction realloc_func;
+   JLFreeFunction free_func;
+   void *alloc_arg;
    char error;
+   char hash_cons;
+   char collecting;
+   char releasing;
 } JLContext;
 
-void *GetFree(JLContext *context);
+void *AllocMemory(JLContext *context, size_t size);
+
+void *ReallocMemory(JLContext *context, void *ptr,
+                    size_t old_size, size_t new_size);
+
+void FreeMemory(JLContext *context, void *ptr, size_t size);
+
+void *AllocInternal(JLContext *context, size_t size);
+
+void *ReallocInternal(JLContext *context, void *ptr,
+                      size_t old_size, size_t new_size);
+
+char *AllocString(JLContext *context, size_t size);
+
+char *ReallocString(JLContext *context, char *str, size_t size);
+
+char *CopyString(JLContext *context, const char *str);
+
+void FreeString(JLContext *context, char *str);
+
+void *GetFree(JLContext *context, BlockType type);
+
+void PutFree(JLContext *context, BlockType type, void *value);
+
+/** Function called for each item in a block. */
+typedef void (*ItemFunction)(JLContext *context, void *item, void *arg);
+
+void ForEachItem(JLContext *context, BlockType type,
+                 ItemFunction func, void *arg);
+
+void ReclaimBlocks(JLContext *context, char all);
+
+void PushRelease(JLContext *context, struct JLValue *value);
+
+size_t ProcessReleases(JLContext *context, size_t budget);
 
-void PutFree(JLContext *context, void *value);
+JLContext *AllocContext(JLAllocFunction alloc_func,
+                        JLReallocFunction realloc_func,
+                        JLFreeFunction free_func,
+                        void *arg);
 
 void FreeContext(JLContext *context);
 
@@ -0,0 +1,361 @@
+/**
+ * @file jl-file.c
+ * @author Joe Wingbermuehle
+ *
+ * Files are mapped into memory and parsed in place.  Pipes and other
+ * files that cannot be mapped are read into memory instead.
+ *
+ */
+
+#include "jl-file.h"
+#include "jl-context.h"
+#include "jl-value.h"
+#include "jl-intern.h"
+#include "jl-module.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
+static FILE *OpenTemp(char *name);
+#ifndef _WIN32
+static char ReadStream(JLContext *context, int fd, MappedFile *file);
+#endif
+
+char MapFile(JLContext *context, const char *filename, MappedFile *file)
+{
+#ifdef _WIN32
+   FILE *fd = fopen(filename, "rb");
+   long size;
+   char *data;
+   if(fd == NULL) {
+      return 0;
+   }
+   fseek(fd, 0, SEEK_END);
+   size = ftell(fd);
+   fseek(fd, 0, SEEK_SET);
+   data = (char*)AllocMemory(context, size > 0 ? size : 1);
+   if(data == NULL) {
+      fclose(fd);
+      return 0;
+   }
+   file->size = fread(data, 1, size > 0 ? size : 0, fd);
+   file->data = data;
+   file->alloc_size = size > 0 ? size : 1;
+   file->mapped = 0;
+   fclose(fd);
+   return 1;
+#else
+   struct stat st;
+   void *data;
+   char result;
+   const int fd = open(filename, O_RDONLY);
+   if(fd < 0) {
+      return 0;
+   }
+   if(fstat(fd, &st) < 0) {
+      close(fd);
+      return 0;
+   }
+   if(S_ISREG(st.st_mode) && st.st_size > 0) {
+      data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(data != MAP_FAILED) {
+#  ifdef MADV_SEQUENTIAL
+         madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+#  endif
+         close(fd);
+         file->data = (const char*)data;
+         file->size = (size_t)st.st_size;
+         file->alloc_size = 0;
+         file->mapped = 1;
+         return 1;
+      }
+   }
+   /* Pipes report a size of 0, so read until the end instead. */
+   result = ReadStream(context, fd, file);
+   close(fd);
+   return result;
+#endif
+}
+
+#ifndef _WIN32
+char ReadStream(JLContext *context, int fd, MappedFile *file)
+{
+   char *data = NULL;
+   size_t len = 0;
+   size_t max_len = 0;
+   for(;;) {
+      ssize_t count;
+      if(len == max_len) {
+         const size_t new_len = max_len ? max_len * 2 : 4096;
+         char *temp = (char*)ReallocMemory(context, data, max_len, new_len);
+         if(temp == NULL) {
+            FreeMemory(context, data, max_len);
+            return 0;
+         }
+         data = temp;
+         max_len = new_len;
+      }
+      count = read(fd, &data[len], max_len - len);
+      if(count == 0) {
+         break;
+      } else if(count < 0) {
+         if(errno == EINTR) {
+            continue;
+         }
+         FreeMemory(context, data, max_len);
+         return 0;
+      }
+      len += (size_t)count;
+   }
+   file->data = data;
+   file->size = len;
+   file->alloc_size = max_len;
+   file->mapped = 0;
+   return 1;
+}
+#endif
+
+void UnmapFile(JLContext *context, MappedFile *file)
+{
+#ifndef _WIN32
+   if(file->mapped) {
+      munmap((void*)file->data, file->size);
+      return;
+   }
+#endif
+   FreeMemory(context, (char*)file->data, file->alloc_size);
+}
+
+void InitWriter(FileWriter *writer, JLContext *context)
+{
+   writer->context = context;
+   writer->data = NULL;
+   writer->len = 0;
+   writer->max_len = 0;
+   writer->failed = 0;
+}
+
+void WriteData(FileWriter *writer, const void *data, size_t len)
+{
+   if(writer->failed) {
+      return;
+   }
+   if(writer->len + len > writer->max_len) {
+      size_t new_len = writer->max_len ? writer->max_len : 4096;
+      char *data;
+      while(new_len < writer->len + len) {
+         new_len *= 2;
+      }
+      data = (char*)ReallocMemory(writer->context, writer->data,
+                                  writer->max_len, new_len);
+      if(data == NULL) {
+         writer->failed = 1;
+         return;
+      }
+      writer->data = data;
+      writer->max_len = new_len;
+   }
+   memcpy(&writer->data[writer->len], data, len);
+   writer->len += len;
+}
+
+void WriteLength(FileWriter *writer, size_t value)
+{
+   /* 7 bits per byte, low bits first. */
+   unsigned char buffer[10];
+   size_t len = 0;
+   while(value >= 0x80) {
+      buffer[len++] = (unsigned char)(value | 0x80);
+      value >>= 7;
+   }
+   buffer[len++] = (unsigned char)value;
+   WriteData(writer, buffer, len);
+}
+
+void WriteString(FileWriter *writer, const char *str)
+{
+   const size_t len = strlen(str);
+   WriteLength(writer, len);
+   WriteData(writer, str, len);
+}
+
+FILE *OpenTemp(char *name)
+{
+   /* Create a new file, replacing the X characters at the end of the
+    * name so that processes saving the same file do not collide. */
+#ifdef _WIN32
+   if(_mktemp_s(name, strlen(name) + 1) != 0) {
+      return NULL;
+   }
+   return fopen(name, "wb");
+#else
+   FILE *result;
+   const int fd = mkstemp(name);
+   if(fd < 0) {
+      return NULL;
+   }
+
+   /* mkstemp makes the file private; saved files are readable by all. */
+   fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+   result = fdopen(fd, "wb");
+   if(result == NULL) {
+      close(fd);
+      remove(name);
+   }
+   return result;
+#endif
+}
+
+char SaveWriter(FileWriter *writer, const char *filename)
+{
+   /* Write to a temporary file and rename it so that readers never see
+    * a partial file.  The buffer is released. */
+   JLContext *context = writer->context;
+   char *temp_name = NULL;
+   char result = 0;
+   FILE *fd = NULL;
+
+   if(!writer->failed) {
+      temp_name = AllocString(context, strlen(filename) + 8);
+   }
+   if(temp_name) {
+      sprintf(temp_name, "%s.XXXXXX", filename);
+      fd = OpenTemp(temp_name);
+   }
+   if(fd) {
+      const size_t written = fwrite(writer->data, 1, writer->len, fd);
+      if(fclose(fd) == 0 && written == writer->len &&
+         rename(temp_name, filename) == 0) {
+         result = 1;
+      } else {
+         remove(temp_name);
+      }
+   }
+
+   FreeString(context, temp_name);
+   FreeMemory(context, writer->data, writer->max_len);
+   writer->data = NULL;
+   writer->len = 0;
+   writer->max_len = 0;
+   return result;
+}
+
+char ReadLength(const char **data, const char *end, size_t *value)
+{
+   unsigned shift = 0;
+   *value = 0;
+   while(*data < end && shift < 64) {
+      const unsigned char ch = (unsigned char)**data;
+      *data += 1;
+      *value |= (size_t)(ch & 0x7F) << shift;
+      if(!(ch & 0x80)) {
+         return 1;
+      }
+      shift += 7;
+   }
+   return 0;
+}
+
+JLValue *ParseData(JLContext *context, const char *data, size_t size,
+                   char *failed)
+{
+   JLValue *result;
+   JLValue **item;
+   const char *line = data;
+   const char *end = data + size;
+   const char hash_cons = context->hash_cons;
+
+   /* Forms are chained together, so they are interned as a whole. */
+   context->hash_cons = 0;
+   result = CreateValue(context, NULL, JLVALUE_LIST);
+   if(result == NULL) {
+      context->hash_cons = hash_cons;
+      *failed = 1;
+      return NULL;
+   }
+   item = &result->value.lst;
+   context->line = 1;
+   *failed = 0;
+   while(line < end) {
+      const char *start = line;
+      JLValue *value = JLParseN(context, &line, end - line);
+      *failed |= context->error;
+      if(value) {
+         *item = value;
+         item = &value->next;
+      } else if(line == start) {
+         break;
+      }
+   }
+   context->hash_cons = hash_cons;
+   if(hash_cons) {
+      result = InternTree(context, result);
+   }
+   return result;
+}
+
+JLValue *JLParseFile(JLContext *context, const char *filename)
+{
+   JLValue *result;
+   MappedFile file;
+   char failed;
+
+   if(!MapFile(context, filename, &file)) {
+      Error(context, "could not open %s", filename);
+      return NULL;
+   }
+   result = ParseData(context, file.data, file.size, &failed);
+   UnmapFile(context, &file);
+   return result;
+}
+
+JLValue *JLEvaluateFile(JLContext *context, const char *filename)
+{
+   /* The file is the current module while it is evaluated so that
+    * include and require find files relative to it. */
+   ModuleNode *outer = context->module;
+   ModuleNode module;
+   JLValue *result = NULL;
+   MappedFile file;
+   const char *line;
+   const char *end;
+
+   if(!MapFile(context, filename, &file)) {
+      Error(context, "could not open %s", filename);
+      return NULL;
+   }
+   module.path = GetModulePath(context, filename);
+   if(module.path) {
+      context->module = &module;
+   }
+
+   line = file.data;
+   end = file.data + file.size;
+   context->line = 1;
+   while(line < end) {
+      const char *start = line;
+      JLValue *value = JLParseN(context, &line, end - line);
+      if(value) {
+         JLRelease(context, result);
+         result = JLEvaluate(context, value);
+         JLRelease(context, value);
+      } else if(line == start) {
+         break;
+      }
+   }
+   UnmapFile(context, &file);
+   if(module.path) {
+      FreeString(context, module.path);
+   }
+   context->module = outer;
+   return result;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file jl-file.h
+ * @author Joe Wingbermuehle
+ *
+ * Loading files.
+ *
+ */
+
+#ifndef JL_FILE_H
+#define JL_FILE_H
+
+#include <stddef.h>
+
+struct JLContext;
+struct JLValue;
+
+/** The contents of a file mapped or read into memory. */
+typedef struct MappedFile {
+   const char *data;
+   size_t size;
+   size_t alloc_size;      /**< Size of the buffer if the file was read. */
+   char mapped;            /**< Set if data must be unmapped. */
+} MappedFile;
+
+char MapFile(struct JLContext *context, const char *filename,
+             MappedFile *file);
+
+void UnmapFile(struct JLContext *context, MappedFile *file);
+
+/** Buffer for building a file. */
+typedef struct FileWriter {
+   struct JLContext *context;
+   char *data;
+   size_t len;
+   size_t max_len;
+   char failed;            /**< Set if the buffer could not grow. */
+} FileWriter;
+
+void InitWriter(FileWriter *writer, struct JLContext *context);
+
+void WriteData(FileWriter *writer, const void *data, size_t len);
+
+void WriteLength(FileWriter *writer, size_t value);
+
+void WriteString(FileWriter *writer, const char *str);
+
+char SaveWriter(FileWriter *writer, const char *filename);
+
+char ReadLength(const char **data, const char *end, size_t *value);
+
+struct JLValue *ParseData(struct JLContext *context,
+                          const char *data,
+                          size_t size,
+                          char *failed);
+
+#endif /* JL_FILE_H */
@@ -8,96 +8,195 @@
 #include "jl-value.h"
 #include "jl-context.h"
 #include "jl-scope.h"
+#include "jl-port.h"
+#include "jl-module.h"
+#include "jl-gc.h"
+#include "jl-builtins.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <stdint.h>
 
-typedef struct InternalFunctionNode {
+/** A builtin and its value.
+ * Builtins are shared by every context and are never modified, so their
+ * values are marked static and are not reference counted.
+ */
+typedef struct BuiltinNode {
    const char *name;
-   JLFunction function;
-} InternalFunctionNode;
+   JLValue value;
+} BuiltinNode;
+
+/** Shorthand for native functions with any number of arguments. */
+#define UNLIMITED    UINT_MAX
+
+/** Value of a builtin special function. */
+#define SPECIAL(func) \
+   { { .special = &(SpecialFunction){ func, NULL } }, \
+     NULL, 1, JLVALUE_SPECIAL, JLFLAG_STATIC, GC_NONE }
+
+/** Value of a builtin native function. */
+#define NATIVE(func, min_args, max_args, types) \
+   { { .native = &(NativeFunction){ func, NULL, min_args, max_args, \
+                                    types } }, \
+     NULL, 1, JLVALUE_NATIVE, JLFLAG_STATIC, GC_NONE }
 
+static char IsTrue(const JLValue *value);
 static char CheckCondition(JLContext *context, JLValue *value);
-static void InvalidArgumentError(JLContext *context, JLValue *args);
-static void TooManyArgumentsError(JLContext *context, JLValue *args);
-static void TooFewArgumentsError(JLContext *context, JLValue *args);
-
-static JLValue *CompareFunc(JLContext *context, JLValue *args, void *extra);
-static JLValue *AddFunc(JLContext *context, JLValue *args, void *extra);
-static JLValue *SubFunc(JLContext *context, JLValue *args, void *extra);
-static JLValue *MulFunc(JLContext *context, JLValue *args, void *extra);
-static JLValue *DivFunc(JLContext *context, JLValue *args, void *extra);
-static JLValue *ModFunc(JLContext *context, JLValue *args, void *extra);
+static JLValue *MakeBoolean(JLContext *context, char cond);
+static char CompareArgs(JLContext *context, JLValue **argv, char equality,
+                        double *diff);
+
 static JLValue *AndFunc(JLContext *context, JLValue *args, void *extra);
 static JLValue *OrFunc(JLContext *context, JLValue *args, void *extra);
-static JLValue *NotFunc(JLContext *context, JLValue *args, void *extra);
 static JLValue *BeginFunc(JLContext *context, JLValue *args, void *extra);
-static JLValue *ConsFunc(JLContext *context, JLValue *args, void *extra);
 static JLValue *DefineFunc(JLContext *context, JLValue *args, void *extra);
-static JLValue *HeadFunc(JLContext *context, JLValue *args, void *extra);
 static JLValue *IfFunc(JLContext *context, JLValue *args, void *extra);
 static JLValue *LambdaFunc(JLContext *context, JLValue *args, void *extra);
-static JLValue *ListFunc(JLContext *context, JLValue *args, void *extra);
-static JLValue *RestFunc(JLContext *context, JLValue *args, void *extra);
-static JLValue *SubstrFunc(JLContext *context, JLValue *args, void *extra);
-static JLValue *ConcatFunc(JLContext *context, JLValue *args, void *extra);
-static JLValue *IsNumberFunc(JLContext *context, JLValue *args, void *extra);
-static JLValue *IsStringFunc(JLContext *context, JLValue *args, void *extra);
-static JLValue *IsListFunc(JLContext *context, JLValue *args, void *extra);
-static JLValue *IsNullFunc(JLContext *context, JLValue *args, void *extra);
-
-static InternalFunctionNode INTERNAL_FUNCTIONS[] = {
-   { "=",         CompareFunc    },
-   { "!=",        CompareFunc    },
-   { ">",         CompareFunc    },
-   { ">=",        CompareFunc    },
-   { "<",         CompareFunc    },
-   { "<=",        CompareFunc    },
-   { "+",         AddFunc        },
-   { "-",         SubFunc        },
-   { "*",         MulFunc        },
-   { "/",         DivFunc        },
-   { "mod",       ModFunc        },
-   { "and",       AndFunc        },
-   { "or",        OrFunc         },
-   { "not",       NotFunc        },
-   { "begin",     BeginFunc      },
-   { "cons",      ConsFunc       },
-   { "define",    DefineFunc     },
-   { "head",      HeadFunc       },
-   { "if",        IfFunc         },
-   { "lambda",    LambdaFunc     },
-   { "list",      ListFunc       },
-   { "rest",      RestFunc       },
-   { "substr",    SubstrFunc     },
-   { "concat",    ConcatFunc     },
-   { "number?",   IsNumberFunc   },
-   { "string?",   IsStringFunc   },
-   { "list?",     IsListFunc     },
-   { "null?",     IsNullFunc     }
+
+static JLValue *EqualFunc(JLContext *context, size_t argc, JLValue **argv,
+                          void *extra);
+static JLValue *NotEqualFunc(JLContext *context, size_t argc,
+                             JLValue **argv, void *extra);
+static JLValue *LessFunc(JLContext *context, size_t argc, JLValue **argv,
+                         void *extra);
+static JLValue *LessEqualFunc(JLContext *context, size_t argc,
+                              JLValue **argv, void *extra);
+static JLValue *GreaterFunc(JLContext *context, size_t argc, JLValue **argv,
+                            void *extra);
+static JLValue *GreaterEqualFunc(JLContext *context, size_t argc,
+                                 JLValue **argv, void *extra);
+static JLValue *AddFunc(JLContext *context, size_t argc, JLValue **argv,
+                        void *extra);
+static JLValue *SubFunc(JLContext *context, size_t argc, JLValue **argv,
+                        void *extra);
+static JLValue *MulFunc(JLContext *context, size_t argc, JLValue **argv,
+                        void *extra);
+static JLValue *DivFunc(JLContext *context, size_t argc, JLValue **argv,
+                        void *extra);
+static JLValue *ModFunc(JLContext *context, size_t argc, JLValue **argv,
+                        void *extra);
+static JLValue *NotFunc(JLContext *context, size_t argc, JLValue **argv,
+                        void *extra);
+static JLValue *ConsFunc(JLContext *context, size_t argc, JLValue **argv,
+                         void *extra);
+static JLValue *HeadFunc(JLContext *context, size_t argc, JLValue **argv,
+                         void *extra);
+static JLValue *ListFunc(JLContext *context, size_t argc, JLValue **argv,
+                         void *extra);
+static JLValue *RestFunc(JLContext *context, size_t argc, JLValue **argv,
+                         void *extra);
+static JLValue *SubstrFunc(JLContext *context, size_t argc, JLValue **argv,
+                           void *extra);
+static JLValue *ConcatFunc(JLContext *context, size_t argc, JLValue **argv,
+                           void *extra);
+static JLValue *IsNumberFunc(JLContext *context, size_t argc,
+                             JLValue **argv, void *extra);
+static JLValue *IsStringFunc(JLContext *context, size_t argc,
+                             JLValue **argv, void *extra);
+static JLValue *IsListFunc(JLContext *context, size_t argc, JLValue **argv,
+                           void *extra);
+static JLValue *IsNullFunc(JLContext *context, size_t argc, JLValue **argv,
+                           void *extra);
+
+static BuiltinNode BUILTINS[] = {
+
+   /* Functions that control the evaluation of their arguments. */
+   { "and",       SPECIAL(AndFunc)                                    },
+   { "or",        SPECIAL(OrFunc)                                     },
+   { "begin",     SPECIAL(BeginFunc)                                  },
+   { "define",    SPECIAL(DefineFunc)                                 },
+   { "if",        SPECIAL(IfFunc)                                     },
+   { "lambda",    SPECIAL(LambdaFunc)                                 },
+
+   /* Functions of evaluated arguments. */
+   { "=",         NATIVE(EqualFunc,        2, 2, JLTYPE_ANY)          },
+   { "!=",        NATIVE(NotEqualFunc,     2, 2, JLTYPE_ANY)          },
+   { ">",         NATIVE(GreaterFunc,      2, 2, JLTYPE_ANY)          },
+   { ">=",        NATIVE(GreaterEqualFunc, 2, 2, JLTYPE_ANY)          },
+   { "<",         NATIVE(LessFunc,         2, 2, JLTYPE_ANY)          },
+   { "<=",        NATIVE(LessEqualFunc,    2, 2, JLTYPE_ANY)          },
+   { "+",         NATIVE(AddFunc,   0, UNLIMITED, JLTYPE_NUMBER)      },
+   { "-",         NATIVE(SubFunc,   1, UNLIMITED, JLTYPE_NUMBER)      },
+   { "*",         NATIVE(MulFunc,   0, UNLIMITED, JLTYPE_NUMBER)      },
+   { "/",         NATIVE(DivFunc,          2, 2, JLTYPE_NUMBER)       },
+   { "mod",       NATIVE(ModFunc,          2, 2, JLTYPE_NUMBER)       },
+   { "not",       NATIVE(NotFunc,          1, 1, JLTYPE_ANY)          },
+   { "cons",      NATIVE(ConsFunc,         2, 2, JLTYPE_ANY)          },
+   { "head",      NATIVE(HeadFunc,         1, 1, JLTYPE_LIST)         },
+   { "list",      NATIVE(ListFunc,  0, UNLIMITED, JLTYPE_ANY)         },
+   { "rest",      NATIVE(RestFunc,         1, 1, JLTYPE_LIST)         },
+   { "substr",    NATIVE(SubstrFunc,       1, 3, JLTYPE_ANY)          },
+   { "concat",    NATIVE(ConcatFunc, 0, UNLIMITED, JLTYPE_STRING)     },
+   { "number?",   NATIVE(IsNumberFunc,     1, 1, JLTYPE_ANY)          },
+   { "string?",   NATIVE(IsStringFunc,     1, 1, JLTYPE_ANY)          },
+   { "list?",     NATIVE(IsListFunc,       1, 1, JLTYPE_ANY)          },
+   { "null?",     NATIVE(IsNullFunc,       1, 1, JLTYPE_ANY)          },
+   { "open-input-file",    NATIVE(OpenInputFileFunc, 1, 1,
+                                  JLTYPE_STRING)                      },
+   { "open-output-file",   NATIVE(OpenOutputFileFunc, 1, 1,
+                                  JLTYPE_STRING)                      },
+   { "close-port",         NATIVE(ClosePortFunc, 1, 1,
+                                  JLTYPE_USERDATA)                    },
+   { "read-line",          NATIVE(ReadLineFunc, 1, 1,
+                                  JLTYPE_USERDATA)                    },
+   { "read-chunk",         NATIVE(ReadChunkFunc, 2, 2,
+                                  JLTYPE_USERDATA | JLTYPE_NUMBER)    },
+   { "read-datum",         NATIVE(ReadDatumFunc, 1, 1,
+                                  JLTYPE_USERDATA)                    },
+   { "write-string",       NATIVE(WriteStringFunc, 1, UNLIMITED,
+                                  JLTYPE_USERDATA | JLTYPE_STRING)    },
+   { "write-datum",        NATIVE(WriteDatumFunc, 1, UNLIMITED,
+                                  JLTYPE_ANY)                         },
+   { "file-lines",         NATIVE(FileLinesFunc, 2, 2,
+                                  JLTYPE_STRING | JLTYPE_LAMBDA)      },
+   { "include",            NATIVE(IncludeFunc, 1, 1, JLTYPE_STRING)   },
+   { "require",            NATIVE(RequireFunc, 1, 1, JLTYPE_STRING)   },
+
+   /* Constants. */
+   { "nil", { { NULL }, NULL, 1, JLVALUE_NIL, JLFLAG_STATIC, GC_NONE }  }
+
 };
-static size_t INTERNAL_FUNCTION_COUNT = sizeof(INTERNAL_FUNCTIONS)
-                                      / sizeof(InternalFunctionNode);
 
-char CheckCondition(JLContext *context, JLValue *value)
+static const size_t BUILTIN_COUNT = sizeof(BUILTINS) / sizeof(BuiltinNode);
+
+unsigned int HashBuiltin(const char *name, uint32_t seed)
 {
-   JLValue *cond = JLEvaluate(context, value);
-   char rc = 0;
-   if(cond) {
-      switch(cond->tag) {
+   /* 32-bit FNV-1a, using the top bits for the slot. */
+   uint32_t hash = seed;
+   while(*name) {
+      hash = (hash ^ (unsigned char)*name++) * 16777619u;
+   }
+   return (unsigned int)(hash >> (32 - BUILTIN_BITS));
+}
+
+const char *GetBuiltinName(size_t index)
+{
+   /* Returns NULL past the last builtin. */
+   return index < BUILTIN_COUNT ? BUILTINS[index].name : NULL;
+}
+
+char IsTrue(const JLValue *value)
+{
+   if(value) {
+      switch(value->tag) {
       case JLVALUE_NUMBER:
-         rc = cond->value.number != 0.0;
-         break;
+         return value->value.number != 0.0;
       case JLVALUE_LIST:
-         rc = cond->value.lst != NULL;
-         break;
+         return value->value.lst != NULL;
       default:
-         rc = 1;
-         break;
+         return 1;
       }
-      JLRelease(context, cond);
    }
+   return 0;
+}
+
+char CheckCondition(JLContext *context, JLValue *value)
+{
+   JLValue *cond = JLEvaluate(context, value);
+   const char rc = IsTrue(cond);
+   JLRelease(context, cond);
    return rc;
 }
 
@@ -116,201 +215,148 @@ void TooFewArgumentsError(JLContext *context, JLValue *args)
    Error(context, "too few arguments to %s", args->value.str);
 }
 
-JLValue *CompareFunc(JLContext *context, JLValue *args, void *extra)
+void NativeArgumentError(JLContext *context)
 {
-   const char *op = args->value.str;
-   JLValue *va = NULL;
-   JLValue *vb = NULL;
-   JLValue *result = NULL;
-   char cond = 0;
-   if(args->next == NULL || args->next->next == NULL) {
-      TooFewArgumentsError(context, args);
-      return NULL;
-   }
-   if(args->next->next->next) {
-      TooManyArgumentsError(context, args);
-      return NULL;
-   }
+   Error(context, "invalid argument to %s", context->native_name);
+}
 
-   va = JLEvaluate(context, args->next);
-   vb = JLEvaluate(context, args->next->next);
-   if(va == NULL || vb == NULL || va->tag != vb->tag) {
+JLValue *MakeBoolean(JLContext *context, char cond)
+{
+   return cond ? JLDefineNumber(context, NULL, 1.0) : NULL;
+}
 
-      if(op[0] == '=') {
-         cond = va == vb;
-      } else if(op[0] == '!') {
-         cond = va != vb;
-      } else {
-         InvalidArgumentError(context, args);
+char CompareArgs(JLContext *context, JLValue **argv, char equality,
+                 double *diff)
+{
+   /* Set diff to the sign of the comparison of two values.  Values of
+    * different types are only compared for equality, in which case they
+    * are equal only if they are the same value.  Returns 0 if the values
+    * cannot be compared. */
+   JLValue *va = argv[0];
+   JLValue *vb = argv[1];
+   *diff = 0.0;
+   if(va == NULL || vb == NULL || va->tag != vb->tag) {
+      if(!equality) {
+         NativeArgumentError(context);
+         return 0;
+      }
+      *diff = va == vb ? 0.0 : 1.0;
+   } else if(va->tag == JLVALUE_NUMBER) {
+      *diff = va->value.number - vb->value.number;
+   } else if(va->tag == JLVALUE_STRING) {
+      /* Shared strings are equal without looking at the contents. */
+      if(va != vb) {
+         *diff = strcmp(va->value.str, vb->value.str);
+      }
+   } else if(va->tag == JLVALUE_USERDATA && equality) {
+      /* User data is equal if it refers to the same host object. */
+      if(va->value.user->type != vb->value.user->type ||
+         va->value.user->data != vb->value.user->data) {
+         *diff = 1.0;
       }
-
    } else {
+      NativeArgumentError(context);
+      return 0;
+   }
+   return 1;
+}
 
-      /* Here we know that va and vb are not nil and are of the same type. */
-      double diff = 0.0;
-      if(va->tag == JLVALUE_NUMBER) {
-         diff = va->value.number - vb->value.number;
-      } else if(va->tag == JLVALUE_STRING) {
-         diff = strcmp(va->value.str, vb->value.str);
-      } else {
-         InvalidArgumentError(context, args);
-      }
+JLValue *EqualFunc(JLContext *context, size_t argc, JLValue **argv,
+                   void *extra)
+{
+   double diff;
+   return MakeBoolean(context, CompareArgs(context, argv, 1, &diff)
+                               && diff == 0.0);
+}
 
-      if(op[0] == '=') {
-         cond = diff == 0.0;
-      } else if(op[0] == '!') {
-         cond = diff != 0.0;
-      } else if(op[0] == '<' && op[1] == 0) {
-         cond = diff < 0.0;
-      } else if(op[0] == '<' && op[1] == '=') {
-         cond = diff <= 0.0;
-      } else if(op[0] == '>' && op[1] == 0) {
-         cond = diff > 0.0;
-      } else if(op[0] == '>' && op[1] == '=') {
-         cond = diff >= 0.0;
-      }
+JLValue *NotEqualFunc(JLContext *context, size_t argc, JLValue **argv,
+                      void *extra)
+{
+   double diff;
+   return MakeBoolean(context, CompareArgs(context, argv, 1, &diff)
+                               && diff != 0.0);
+}
 
-   }
+JLValue *LessFunc(JLContext *context, size_t argc, JLValue **argv,
+                  void *extra)
+{
+   double diff;
+   return MakeBoolean(context, CompareArgs(context, argv, 0, &diff)
+                               && diff < 0.0);
+}
 
-   if(cond) {
-      result = JLDefineNumber(context, NULL, 1.0);
-   }
+JLValue *LessEqualFunc(JLContext *context, size_t argc, JLValue **argv,
+                       void *extra)
+{
+   double diff;
+   return MakeBoolean(context, CompareArgs(context, argv, 0, &diff)
+                               && diff <= 0.0);
+}
 
-   JLRelease(context, va);
-   JLRelease(context, vb);
-   return result;
+JLValue *GreaterFunc(JLContext *context, size_t argc, JLValue **argv,
+                     void *extra)
+{
+   double diff;
+   return MakeBoolean(context, CompareArgs(context, argv, 0, &diff)
+                               && diff > 0.0);
 }
 
-JLValue *AddFunc(JLContext *context, JLValue *args, void *extra)
+JLValue *GreaterEqualFunc(JLContext *context, size_t argc, JLValue **argv,
+                          void *extra)
+{
+   double diff;
+   return MakeBoolean(context, CompareArgs(context, argv, 0, &diff)
+                               && diff >= 0.0);
+}
+
+JLValue *AddFunc(JLContext *context, size_t argc, JLValue **argv,
+                 void *extra)
 {
-   JLValue *vp;
    double sum = 0.0;
-   for(vp = args->next; vp; vp = vp->next) {
-      JLValue *arg = JLEvaluate(context, vp);
-      if(arg == NULL || arg->tag != JLVALUE_NUMBER) {
-         InvalidArgumentError(context, args);
-         JLRelease(context, arg);
-         return NULL;
-      }
-      sum += arg->value.number;
-      JLRelease(context, arg);
+   size_t i;
+   for(i = 0; i < argc; i++) {
+      sum += argv[i]->value.number;
    }
    return JLDefineNumber(context, NULL, sum);
 }
 
-JLValue *SubFunc(JLContext *context, JLValue *args, void *extra)
+JLValue *SubFunc(JLContext *context, size_t argc, JLValue **argv,
+                 void *extra)
 {
-   JLValue *vp = args->next;
-   JLValue *arg = NULL;
-   double total = 0.0;
-
-   arg = JLEvaluate(context, vp);
-   if(arg == NULL || arg->tag != JLVALUE_NUMBER) {
-      InvalidArgumentError(context, args);
-      JLRelease(context, arg);
-      return NULL;
-   }
-   total = arg->value.number;
-   JLRelease(context, arg);
-
-   for(vp = vp->next; vp; vp = vp->next) {
-      arg = JLEvaluate(context, vp);
-      if(arg == NULL || arg->tag != JLVALUE_NUMBER) {
-         InvalidArgumentError(context, args);
-         JLRelease(context, arg);
-         return NULL;
-      }
-      total -= arg->value.number;
-      JLRelease(context, arg);
+   double total = argv[0]->value.number;
+   size_t i;
+   for(i = 1; i < argc; i++) {
+      total -= argv[i]->value.number;
    }
-
    return JLDefineNumber(context, NULL, total);
-
 }
 
-JLValue *MulFunc(JLContext *context, JLValue *args, void *extra)
+JLValue *MulFunc(JLContext *context, size_t argc, JLValue **argv,
+                 void *extra)
 {
-   JLValue *vp;
    double product = 1.0;
-   for(vp = args->next; vp; vp = vp->next) {
-      JLValue *arg = JLEvaluate(context, vp);
-      if(arg == NULL || arg->tag != JLVALUE_NUMBER) {
-         InvalidArgumentError(context, args);
-         JLRelease(context, arg);
-         return NULL;
-      }
-      product *= arg->value.number;
-      JLRelease(context, arg);
+   size_t i;
+   for(i = 0; i < argc; i++) {
+      product *= argv[i]->value.number;
    }
    return JLDefineNumber(context, NULL, product);
 }
 
-JLValue *DivFunc(JLContext *context, JLValue *args, void *extra)
+JLValue *DivFunc(JLContext *context, size_t argc, JLValue **argv,
+                 void *extra)
 {
-   JLValue *va = NULL;
-   JLValue *vb = NULL;
-   JLValue *result = NULL;
-
-   va = JLEvaluate(context, args->next);
-   if(va == NULL || va->tag != JLVALUE_NUMBER) {
-      InvalidArgumentError(context, args);
-      goto div_done;
-   }
-   vb = JLEvaluate(context, args->next->next);
-   if(vb == NULL || vb->tag != JLVALUE_NUMBER) {
-      InvalidArgumentError(context, args);
-      goto div_done;
-   }
-   if(args->next->next->next) {
-      TooManyArgumentsError(context, args);
-      goto div_done;
-   }
-
-   result = JLDefineNumber(context, NULL, va->value.number / vb->value.number);
-
-div_done:
-
-   JLRelease(context, va);
-   JLRelease(context, vb);
-   return result;
-
+   return JLDefineNumber(context, NULL,
+                         argv[0]->value.number / argv[1]->value.number);
 }
 
-JLValue *ModFunc(JLContext *context, JLValue *args, void *extra)
+JLValue *ModFunc(JLContext *context, size_t argc, JLValue **argv,
+                 void *extra)
 {
-
-   JLValue *va = NULL;
-   JLValue *vb = NULL;
-   JLValue *result = NULL;
-   long temp;
-
-   va = JLEvaluate(context, args->next);
-   if(va == NULL || va->tag != JLVALUE_NUMBER) {
-      InvalidArgumentError(context, args);
-      goto mod_done;
-   }
-   vb = JLEvaluate(context, args->next->next);
-   if(vb == NULL || vb->tag != JLVALUE_NUMBER) {
-      InvalidArgumentError(context, args);
-      goto mod_done;
-   }
-   if(args->next->next->next) {
-      TooManyArgumentsError(context, args);
-      goto mod_done;
-   }
-   temp = (long)vb->value.number;
+   const long temp = (long)argv[1]->value.number;
    if(temp == 0) {
-      goto mod_done;
+      return NULL;
    }
-
-   result = JLDefineNumber(context, NULL, (long)va->value.number % temp);
-
-mod_done:
-
-   JLRelease(context, va);
-   JLRelease(context, vb);
-   return result;
-
+   return JLDefineNumber(context, NULL, (long)argv[0]->value.number % temp);
 }
 
 JLValue *AndFunc(JLContext *context, JLValue *args, void *extra)
@@ -335,28 +381,19 @@ JLValue *OrFunc(JLContext *context, JLValue *args, void *extra)
    return NULL;
 }
 
-JLValue *NotFunc(JLContext *context, JLValue *args, void *extra)
+JLValue *NotFunc(JLContext *context, size_t argc, JLValue **argv,
+                 void *extra)
 {
-   if(args->next == NULL) {
-      TooFewArgumentsError(context, args);
-      return NULL;
-   }
-   if(args->next->next != NULL) {
-      TooManyArgumentsError(context, args);
-      return NULL;
-   }
-   if(!CheckCondition(context, args->next)) {
-      return JLDefineNumber(context, NULL, 1.0);
-   } else {
-      return NULL;
-   }
+   return MakeBoolean(context, !IsTrue(argv[0]));
 }
 
 JLValue *BeginFunc(JLContext *context, JLValue *args, void *extra)
 {
    JLValue *vp;
    JLValue *result = NULL;
-   JLEnterScope(context);
+   if(!JLEnterScope(context)) {
+      return NULL;
+   }
    for(vp = args->next; vp; vp = vp->next) {
       JLRelease(context, result);
       result = JLEvaluate(context, vp);
@@ -365,38 +402,27 @@ JLValue *BeginFunc(JLContext *context, JLValue *args, void *extra)
    return result;
 }
 
-JLValue *ConsFunc(JLContext *context, JLValue *args, void *extra)
+JLValue *ConsFunc(JLContext *context, size_t argc, JLValue **argv,
+                  void *extra)
 {
-   JLValue *head = NULL;
-   JLValue *rest = NULL;
-   JLValue *temp = NULL;
-   JLValue *result = NULL;
+   JLValue *rest = argv[1];
+   JLValue *head;
+   JLValue *result;
 
-   if(args->next == NULL || args->next->next == NULL) {
-      TooFewArgumentsError(context, args);
-      return NULL;
-   }
-   if(args->next->next->next) {
-      TooManyArgumentsError(context, args);
+   if(rest != NULL && rest->tag != JLVALUE_LIST) {
+      NativeArgumentError(context);
       return NULL;
    }
 
-   rest = JLEvaluate(context, args->next->next);
-   if(rest != NULL && rest->tag != JLVALUE_LIST) {
-      InvalidArgumentError(context, args);
-      JLRelease(context, rest);
+   head = CopyValue(context, argv[0]);
+   result = head ? CreateValue(context, NULL, JLVALUE_LIST) : NULL;
+   if(result == NULL) {
+      JLRelease(context, head);
       return NULL;
    }
-
-   temp = JLEvaluate(context, args->next);
-   head = CopyValue(context, temp);
-   JLRelease(context, temp);
-
-   result = CreateValue(context, NULL, JLVALUE_LIST);
    if(rest) {
       head->next = rest->value.lst;
       JLRetain(context, rest->value.lst);
-      JLRelease(context, rest);
    }
    result->value.lst = head;
 
@@ -420,22 +446,11 @@ JLValue *DefineFunc(JLContext *context, JLValue *args, void *extra)
    return result;
 }
 
-JLValue *HeadFunc(JLContext *context, JLValue *args, void *extra)
+JLValue *HeadFunc(JLContext *context, size_t argc, JLValue **argv,
+                  void *extra)
 {
-   JLValue *result = NULL;
-   JLValue *vp = JLEvaluate(context, args->next);
-
-   if(vp == NULL || vp->tag != JLVALUE_LIST) {
-      InvalidArgumentError(context, args);
-      goto head_done;
-   }
-
-   result = vp->value.lst;
+   JLValue *result = argv[0]->value.lst;
    JLRetain(context, result);
-
-head_done:
-
-   JLRelease(context, vp);
    return result;
 }
 
@@ -461,10 +476,17 @@ JLValue *LambdaFunc(JLContext *context, JLValue *args, void *extra)
    }
 
    scope = CreateValue(context, NULL, JLVALUE_SCOPE);
+   if(scope == NULL) {
+      return NULL;
+   }
    scope->value.scope = context->scope;
    context->scope->count += 1;
 
    result = CreateValue(context, NULL, JLVALUE_LAMBDA);
+   if(result == NULL) {
+      JLRelease(context, scope);
+      return NULL;
+   }
    result->value.lst = scope;
    result->value.lst->next = args->next;
    JLRetain(context, args->next);
@@ -472,230 +494,201 @@ JLValue *LambdaFunc(JLContext *context, JLValue *args, void *extra)
    return result;
 }
 
-JLValue *ListFunc(JLContext *context, JLValue *args, void *extra)
+JLValue *ListFunc(JLContext *context, size_t argc, JLValue **argv,
+                  void *extra)
 {
+   /* The items are copied since evaluated values may be shared. */
    JLValue *result = NULL;
-   if(args->next) {
+   if(argc > 0) {
+      JLValue **item;
+      size_t i;
       result = CreateValue(context, NULL, JLVALUE_LIST);
-      JLValue **item = &result->value.lst;
-      JLValue *vp;
-      for(vp = args->next; vp; vp = vp->next) {
-         JLValue *arg = JLEvaluate(context, vp);
-         JLValue *temp = CopyValue(context, arg);
-         *item = temp;
-         item = &temp->next;
-         JLRelease(context, arg);
+      item = result ? &result->value.lst : NULL;
+      for(i = 0; i < argc && item; i++) {
+         *item = CopyValue(context, argv[i]);
+         item = *item ? &(*item)->next : NULL;
+      }
+      if(item == NULL) {
+         JLRelease(context, result);
+         result = NULL;
       }
    }
    return result;
 }
 
-JLValue *RestFunc(JLContext *context, JLValue *args, void *extra)
+JLValue *RestFunc(JLContext *context, size_t argc, JLValue **argv,
+                  void *extra)
 {
    JLValue *result = NULL;
-   JLValue *vp = JLEvaluate(context, args->next);
-
-   if(vp == NULL || vp->tag != JLVALUE_LIST) {
-      InvalidArgumentError(context, args);
-      goto rest_done;
-   }
-
-   if(vp->value.lst && vp->value.lst->next) {
+   JLValue *lst = argv[0]->value.lst;
+   if(lst && lst->next) {
       result = CreateValue(context, NULL, JLVALUE_LIST);
-      result->value.lst = vp->value.lst->next;
-      JLRetain(context, result->value.lst);
+      if(result) {
+         result->value.lst = lst->next;
+         JLRetain(context, result->value.lst);
+      }
    }
-
-rest_done:
-
-   JLRelease(context, vp);
    return result;
 }
 
-JLValue *SubstrFunc(JLContext *context, JLValue *args, void *extra)
+JLValue *SubstrFunc(JLContext *context, size_t argc, JLValue **argv,
+                    void *extra)
 {
-   JLValue *result   = NULL;
-   JLValue *str      = NULL;
-   JLValue *sval     = NULL;
-   JLValue *lval     = NULL;
-   size_t start      = 0;
-   size_t len        = (size_t)-1;
+   /* The start and length are optional and can be nil. */
+   JLValue *result = NULL;
+   JLValue *str = argv[0];
+   size_t start = 0;
+   size_t len = (size_t)-1;
    size_t slen;
+   size_t i;
+   char *dest;
 
-   str = JLEvaluate(context, args->next);
-   if(!str || str->tag != JLVALUE_STRING) {
-      InvalidArgumentError(context, args);
-      goto substr_done;
+   if(str == NULL || str->tag != JLVALUE_STRING) {
+      NativeArgumentError(context);
+      return NULL;
    }
-
-   sval = JLEvaluate(context, args->next->next);
-   if(sval) {
-      if(sval->tag != JLVALUE_NUMBER) {
-         InvalidArgumentError(context, args);
-         goto substr_done;
+   for(i = 1; i < argc; i++) {
+      if(argv[i] && argv[i]->tag != JLVALUE_NUMBER) {
+         NativeArgumentError(context);
+         return NULL;
       }
-      start = (size_t)sval->value.number;
    }
-
-   if(args->next->next) {
-      if(args->next->next->next && args->next->next->next->next) {
-         TooManyArgumentsError(context, args);
-         goto substr_done;
-      }
-      lval = JLEvaluate(context, args->next->next->next);
-      if(lval) {
-         if(lval->tag != JLVALUE_NUMBER) {
-            InvalidArgumentError(context, args);
-            goto substr_done;
-         }
-         len = (size_t)lval->value.number;
-      }
+   if(argc > 1 && argv[1]) {
+      start = (size_t)argv[1]->value.number;
+   }
+   if(argc > 2 && argv[2]) {
+      len = (size_t)argv[2]->value.number;
    }
 
    slen = strlen(str->value.str);
    if(start < slen && len > 0) {
       len = slen - start > len ? len : slen - start;
+      dest = AllocString(context, len + 1);
+      if(dest == NULL) {
+         return NULL;
+      }
+      memcpy(dest, &str->value.str[start], len);
+      dest[len] = 0;
       result = CreateValue(context, NULL, JLVALUE_STRING);
-      result->value.str = (char*)malloc(len + 1);
-      memcpy(result->value.str, &str->value.str[start], len);
-      result->value.str[len] = 0;
-   }
-
-substr_done:
-
-   JLRelease(context, str);
-   JLRelease(context, sval);
-   JLRelease(context, lval);
-
-   return result;
-
-}
-
-JLValue *ConcatFunc(JLContext *context, JLValue *args, void *extra)
-{
-   JLValue *result = CreateValue(context, NULL, JLVALUE_STRING);
-   JLValue *vp;
-   size_t len = 0;
-   size_t max_len = 8;
-   result->value.str = (char*)malloc(max_len);
-   for(vp = args->next; vp; vp = vp->next) {
-      JLValue *arg = JLEvaluate(context, vp);
-      if(arg == NULL || arg->tag != JLVALUE_STRING) {
-         InvalidArgumentError(context, args);
-         JLRelease(context, arg);
-         JLRelease(context, result);
+      if(result == NULL) {
+         FreeString(context, dest);
          return NULL;
-      } else {
-         const size_t l = strlen(arg->value.str);
-         const size_t new_len = len + l;
-         if(new_len >= max_len) {
-            max_len = new_len + 1;
-            result->value.str = (char*)realloc(result->value.str, max_len);
-         }
-         memcpy(&result->value.str[len], arg->value.str, l);
-         len = new_len;
       }
-      JLRelease(context, arg);
+      result->value.str = dest;
    }
-   result->value.str[len] = 0;
    return result;
 }
 
-JLValue *IsNumberFunc(JLContext *context, JLValue *args, void *extra)
+JLValue *ConcatFunc(JLContext *context, size_t argc, JLValue **argv,
+                    void *extra)
 {
-   JLValue *arg = NULL;
-   JLValue *result = NULL;
-
-   if(args->next == NULL) {
-      TooFewArgumentsError(context, args);
+   /* The length is known up front, so the result is built in place. */
+   JLValue *result;
+   size_t len = 0;
+   size_t i;
+   char *dest;
+   for(i = 0; i < argc; i++) {
+      len += strlen(argv[i]->value.str);
+   }
+   dest = AllocString(context, len + 1);
+   if(dest == NULL) {
       return NULL;
    }
-   if(args->next->next) {
-      TooManyArgumentsError(context, args);
+   result = CreateValue(context, NULL, JLVALUE_STRING);
+   if(result == NULL) {
+      FreeString(context, dest);
       return NULL;
    }
-
-   arg = JLEvaluate(context, args->next);
-   if(arg && arg->tag == JLVALUE_NUMBER) {
-      result = JLDefineNumber(context, NULL, 1.0);
+   result->value.str = dest;
+   for(i = 0; i < argc; i++) {
+      const size_t l = strlen(argv[i]->value.str);
+      memcpy(dest, argv[i]->value.str, l);
+      dest += l;
    }
-   JLRelease(context, arg);
+   *dest = 0;
    return result;
 }
 
-JLValue *IsStringFunc(JLContext *context, JLValue *args, void *extra)
+JLValue *IsNumberFunc(JLContext *context, size_t argc, JLValue **argv,
+                      void *extra)
 {
-   JLValue *arg = NULL;
-   JLValue *result = NULL;
-
-   if(args->next == NULL) {
-      TooFewArgumentsError(context, args);
-      return NULL;
-   }
-   if(args->next->next) {
-      TooManyArgumentsError(context, args);
-      return NULL;
-   }
-
-   arg = JLEvaluate(context, args->next);
-   if(arg && arg->tag == JLVALUE_STRING) {
-      result = JLDefineNumber(context, NULL, 1.0);
-   }
-   JLRelease(context, arg);
-   return result;
-
+   return MakeBoolean(context, argv[0] && argv[0]->tag == JLVALUE_NUMBER);
 }
 
-JLValue *IsListFunc(JLContext *context, JLValue *args, void *extra)
+JLValue *IsStringFunc(JLContext *context, size_t argc, JLValue **argv,
+                      void *extra)
 {
-   JLValue *arg = NULL;
-   JLValue *result = NULL;
+   return MakeBoolean(context, argv[0] && argv[0]->tag == JLVALUE_STRING);
+}
 
-   if(args->next == NULL) {
-      TooFewArgumentsError(context, args);
-      return NULL;
-   }
-   if(args->next->next) {
-      TooManyArgumentsError(context, args);
-      return NULL;
-   }
+JLValue *IsListFunc(JLContext *context, size_t argc, JLValue **argv,
+                    void *extra)
+{
+   return MakeBoolean(context, argv[0] && argv[0]->tag == JLVALUE_LIST);
+}
 
-   arg = JLEvaluate(context, args->next);
-   if(arg && arg->tag == JLVALUE_LIST) {
-      result = JLDefineNumber(context, NULL, 1.0);
-   }
-   JLRelease(context, arg);
-   return result;
+JLValue *IsNullFunc(JLContext *context, size_t argc, JLValue **argv,
+                    void *extra)
+{
+   return MakeBoolean(context, argv[0] == NULL);
 }
 
-JLValue *IsNullFunc(JLContext *context, JLValue *args, void *extra)
+char FindBuiltin(const char *name, JLValue **value)
 {
-   JLValue *arg = NULL;
+   const unsigned char index = BUILTIN_TABLE[HashBuiltin(name,
+                                                         BUILTIN_SEED)];
+   if(index > 0 && !strcmp(BUILTINS[index - 1].name, name)) {
+      const BuiltinNode *node = &BUILTINS[index - 1];
+      *value = node->value.tag == JLVALUE_NIL ? NULL
+             : (JLValue*)&node->value;
+      return 1;
+   }
+   return 0;
+}
 
-   if(args->next == NULL) {
-      TooFewArgumentsError(context, args);
-      return NULL;
-   }
-   if(args->next->next) {
-      TooManyArgumentsError(context, args);
-      return NULL;
+const char *GetFunctionName(JLFunction func)
+{
+   size_t i;
+   for(i = 0; i < BUILTIN_COUNT; i++) {
+      const JLValue *value = &BUILTINS[i].value;
+      if(value->tag == JLVALUE_SPECIAL &&
+         value->value.special->func == func) {
+         return BUILTINS[i].name;
+      }
    }
+   return NULL;
+}
 
-   arg = JLEvaluate(context, args->next);
-   if(arg == NULL) {
-      return JLDefineNumber(context, NULL, 1.0);
-   } else {
-      JLRelease(context, arg);
-      return NULL;
+JLFunction GetFunction(const char *name)
+{
+   JLValue *value;
+   if(FindBuiltin(name, &value) && value &&
+      value->tag == JLVALUE_SPECIAL) {
+      return value->value.special->func;
    }
+   return NULL;
 }
 
-void RegisterFunctions(JLContext *context)
+const char *GetNativeName(JLNativeFunction func)
 {
    size_t i;
-   for(i = 0; i < INTERNAL_FUNCTION_COUNT; i++) {
-      JLDefineSpecial(context, INTERNAL_FUNCTIONS[i].name,
-                      INTERNAL_FUNCTIONS[i].function, NULL);
+   for(i = 0; i < BUILTIN_COUNT; i++) {
+      const JLValue *value = &BUILTINS[i].value;
+      if(value->tag == JLVALUE_NATIVE &&
+         value->value.native->func == func) {
+         return BUILTINS[i].name;
+      }
    }
+   return NULL;
 }
 
+char GetNative(const char *name, NativeFunction *native)
+{
+   JLValue *value;
+   if(FindBuiltin(name, &value) && value &&
+      value->tag == JLVALUE_NATIVE) {
+      *native = *value->value.native;
+      return 1;
+   }
+   return 0;
+}
@@ -9,8 +9,41 @@
 #ifndef JL_FUNC_H
 #define JL_FUNC_H
 
+#include "jl.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Number of bits in a slot of the builtin hash table. */
+#define BUILTIN_BITS    7
+
+/** Number of slots in the builtin hash table. */
+#define BUILTIN_SLOTS   (1u << BUILTIN_BITS)
+
 struct JLContext;
+struct JLValue;
+struct NativeFunction;
+
+unsigned int HashBuiltin(const char *name, uint32_t seed);
+
+const char *GetBuiltinName(size_t index);
+
+char FindBuiltin(const char *name, struct JLValue **value);
+
+const char *GetFunctionName(JLFunction func);
+
+JLFunction GetFunction(const char *name);
+
+const char *GetNativeName(JLNativeFunction func);
+
+char GetNative(const char *name, struct NativeFunction *native);
+
+void InvalidArgumentError(struct JLContext *context, struct JLValue *args);
+
+void TooManyArgumentsError(struct JLContext *context, struct JLValue *args);
+
+void TooFewArgumentsError(struct JLContext *context, struct JLValue *args);
 
-void RegisterFunctions(struct JLContext *context);
+void NativeArgumentError(struct JLContext *context);
 
 #endif /* JL_FUNC_H */
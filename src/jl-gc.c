@@ -0,0 +1,398 @@
+/**
+ * @file jl-gc.c
+ * @author Joe Wingbermuehle
+ *
+ * Values are reference counted, but lambdas refer to the scope in which
+ * they were created and scopes refer to the values bound in them, so
+ * reference cycles are common.  The collector finds them by subtracting
+ * the references held by values and scopes from the reference counts of
+ * their children.  Anything left with a nonzero count is referenced from
+ * outside of the heap (by the host, the evaluator, or the context) and is
+ * used as a root; everything not reachable from a root is garbage.
+ *
+ */
+
+#include "jl-gc.h"
+#include "jl-context.h"
+#include "jl-value.h"
+#include "jl-scope.h"
+#include "jl-intern.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/** Operations applied to the children of a node. */
+#define VISIT_SUBTRACT  0
+#define VISIT_MARK      1
+#define VISIT_RESTORE   2
+
+/** Minimum growth in value and scope items before collecting again. */
+#define GC_MIN_ITEMS    (16 * BLOCK_SIZE)
+
+/** Stack of nodes to be marked.
+ * Scopes are distinguished from values by setting the low bit.
+ */
+typedef struct MarkStack {
+   JLContext *context;
+   uintptr_t *items;
+   size_t count;
+   size_t max_count;
+   size_t live;      /**< Number of live nodes found. */
+   char failed;      /**< Set if the stack could not grow. */
+} MarkStack;
+
+static void Push(MarkStack *stack, uintptr_t item);
+static void VisitValue(MarkStack *stack, JLValue *value, char op);
+static void VisitScope(MarkStack *stack, ScopeNode *scope, char op);
+static void VisitValueChildren(MarkStack *stack, JLValue *value, char op);
+static void VisitScopeChildren(MarkStack *stack, ScopeNode *scope, char op);
+static void DrainStack(MarkStack *stack);
+static void PrepareValue(JLContext *context, void *item, void *arg);
+static void PrepareScope(JLContext *context, void *item, void *arg);
+static void SubtractValue(JLContext *context, void *item, void *arg);
+static void SubtractScope(JLContext *context, void *item, void *arg);
+static void MarkValue(JLContext *context, void *item, void *arg);
+static void MarkScope(JLContext *context, void *item, void *arg);
+static void KeepValue(JLContext *context, void *item, void *arg);
+static void KeepScope(JLContext *context, void *item, void *arg);
+static void RestoreValue(JLContext *context, void *item, void *arg);
+static void RestoreScope(JLContext *context, void *item, void *arg);
+static void SweepValue(JLContext *context, void *item, void *arg);
+static void SweepScope(JLContext *context, void *item, void *arg);
+
+void Push(MarkStack *stack, uintptr_t item)
+{
+   if(stack->count == stack->max_count) {
+      const size_t old_max = stack->max_count;
+      const size_t new_max = old_max ? old_max * 2 : 256;
+      uintptr_t *items = (uintptr_t*)ReallocInternal(stack->context,
+                                        stack->items,
+                                        old_max * sizeof(uintptr_t),
+                                        new_max * sizeof(uintptr_t));
+      if(items == NULL) {
+         stack->failed = 1;
+         return;
+      }
+      stack->items = items;
+      stack->max_count = new_max;
+   }
+   stack->items[stack->count++] = item;
+}
+
+void VisitValue(MarkStack *stack, JLValue *value, char op)
+{
+   /* Builtins are shared by every context and never collected. */
+   if(value->flags & JLFLAG_STATIC) {
+      return;
+   }
+   switch(op) {
+   case VISIT_SUBTRACT:
+      value->count -= 1;
+      break;
+   case VISIT_MARK:
+      if(value->color == GC_CANDIDATE) {
+         value->color = GC_LIVE;
+         Push(stack, (uintptr_t)value);
+      }
+      break;
+   default:
+      value->count += 1;
+      break;
+   }
+}
+
+void VisitScope(MarkStack *stack, ScopeNode *scope, char op)
+{
+   switch(op) {
+   case VISIT_SUBTRACT:
+      scope->count -= 1;
+      break;
+   case VISIT_MARK:
+      if(scope->color == GC_CANDIDATE) {
+         scope->color = GC_LIVE;
+         Push(stack, (uintptr_t)scope | 1);
+      }
+      break;
+   default:
+      scope->count += 1;
+      break;
+   }
+}
+
+void VisitValueChildren(MarkStack *stack, JLValue *value, char op)
+{
+   switch(value->tag) {
+   case JLVALUE_LIST:
+   case JLVALUE_LAMBDA:
+      if(value->value.lst) {
+         VisitValue(stack, value->value.lst, op);
+      }
+      break;
+   case JLVALUE_SCOPE:
+      VisitScope(stack, (ScopeNode*)value->value.scope, op);
+      break;
+   default:
+      break;
+   }
+   if(value->next) {
+      VisitValue(stack, value->next, op);
+   }
+}
+
+void VisitScopeChildren(MarkStack *stack, ScopeNode *scope, char op)
+{
+   /* Walk the bindings without a stack by temporarily threading the
+    * tree (the tree is restored by the time the walk completes). */
+   BindingNode *node = scope->bindings;
+   while(node) {
+      if(node->left) {
+         BindingNode *pred = node->left;
+         while(pred->right && pred->right != node) {
+            pred = pred->right;
+         }
+         if(pred->right == NULL) {
+            pred->right = node;
+            node = node->left;
+            continue;
+         }
+         pred->right = NULL;
+      }
+      if(node->value) {
+         VisitValue(stack, node->value, op);
+      }
+      node = node->right;
+   }
+   if(scope->next) {
+      VisitScope(stack, scope->next, op);
+   }
+}
+
+void DrainStack(MarkStack *stack)
+{
+   while(stack->count > 0) {
+      const uintptr_t item = stack->items[--stack->count];
+      if(item & 1) {
+         VisitScopeChildren(stack, (ScopeNode*)(item & ~(uintptr_t)1),
+                            VISIT_MARK);
+      } else {
+         VisitValueChildren(stack, (JLValue*)item, VISIT_MARK);
+      }
+   }
+}
+
+void PrepareValue(JLContext *context, void *item, void *arg)
+{
+   /* Values that could not be queued for release have no references
+    * but still need to be freed. */
+   JLValue *value = (JLValue*)item;
+   if(value->count > 0 || (value->flags & JLFLAG_PENDING)) {
+      value->color = GC_CANDIDATE;
+   }
+}
+
+void PrepareScope(JLContext *context, void *item, void *arg)
+{
+   ScopeNode *scope = (ScopeNode*)item;
+   if(scope->count > 0) {
+      scope->color = GC_CANDIDATE;
+   }
+}
+
+void SubtractValue(JLContext *context, void *item, void *arg)
+{
+   JLValue *value = (JLValue*)item;
+   if(value->color == GC_CANDIDATE) {
+      VisitValueChildren((MarkStack*)arg, value, VISIT_SUBTRACT);
+   }
+}
+
+void SubtractScope(JLContext *context, void *item, void *arg)
+{
+   ScopeNode *scope = (ScopeNode*)item;
+   if(scope->color == GC_CANDIDATE) {
+      VisitScopeChildren((MarkStack*)arg, scope, VISIT_SUBTRACT);
+   }
+}
+
+void MarkValue(JLContext *context, void *item, void *arg)
+{
+   JLValue *value = (JLValue*)item;
+   if(value->color == GC_CANDIDATE && value->count > 0) {
+      value->color = GC_LIVE;
+      VisitValueChildren((MarkStack*)arg, value, VISIT_MARK);
+      DrainStack((MarkStack*)arg);
+   }
+}
+
+void MarkScope(JLContext *context, void *item, void *arg)
+{
+   ScopeNode *scope = (ScopeNode*)item;
+   if(scope->color == GC_CANDIDATE && scope->count > 0) {
+      scope->color = GC_LIVE;
+      VisitScopeChildren((MarkStack*)arg, scope, VISIT_MARK);
+      DrainStack((MarkStack*)arg);
+   }
+}
+
+void KeepValue(JLContext *context, void *item, void *arg)
+{
+   JLValue *value = (JLValue*)item;
+   if(value->color == GC_CANDIDATE) {
+      value->color = GC_LIVE;
+   }
+}
+
+void KeepScope(JLContext *context, void *item, void *arg)
+{
+   ScopeNode *scope = (ScopeNode*)item;
+   if(scope->color == GC_CANDIDATE) {
+      scope->color = GC_LIVE;
+   }
+}
+
+void RestoreValue(JLContext *context, void *item, void *arg)
+{
+   JLValue *value = (JLValue*)item;
+   if(value->color == GC_LIVE) {
+      value->color = GC_NONE;
+      VisitValueChildren((MarkStack*)arg, value, VISIT_RESTORE);
+      ((MarkStack*)arg)->live += 1;
+   }
+}
+
+void RestoreScope(JLContext *context, void *item, void *arg)
+{
+   ScopeNode *scope = (ScopeNode*)item;
+   if(scope->color == GC_LIVE) {
+      scope->color = GC_NONE;
+      VisitScopeChildren((MarkStack*)arg, scope, VISIT_RESTORE);
+      ((MarkStack*)arg)->live += 1;
+   }
+}
+
+void SweepValue(JLContext *context, void *item, void *arg)
+{
+   /* References to other garbage are simply dropped and references
+    * to live nodes were already removed from their counts. */
+   JLValue *value = (JLValue*)item;
+   if(value->color == GC_CANDIDATE) {
+      if(value->flags & JLFLAG_INTERNED) {
+         RemoveInterned(context, value);
+      }
+      switch(value->tag) {
+      case JLVALUE_STRING:
+      case JLVALUE_VARIABLE:
+         FreeString(context, value->value.str);
+         break;
+      case JLVALUE_USERDATA:
+         ReleaseUserData(context, value->value.user);
+         break;
+      case JLVALUE_SPECIAL:
+         PutFree(context, BLOCK_NODE, value->value.special);
+         break;
+      case JLVALUE_NATIVE:
+         PutFree(context, BLOCK_NODE, value->value.native);
+         break;
+      default:
+         break;
+      }
+      value->color = GC_NONE;
+      value->count = 0;
+      value->flags &= ~JLFLAG_PENDING;
+      PutFree(context, BLOCK_VALUE, value);
+   }
+}
+
+void SweepScope(JLContext *context, void *item, void *arg)
+{
+   ScopeNode *scope = (ScopeNode*)item;
+   if(scope->color == GC_CANDIDATE) {
+      BindingNode *node = scope->bindings;
+      while(node) {
+         if(node->left) {
+            /* Rotate right so that the tree can be freed in order. */
+            BindingNode *left = node->left;
+            node->left = left->right;
+            left->right = node;
+            node = left;
+         } else {
+            BindingNode *right = node->right;
+            FreeString(context, node->name);
+            PutFree(context, BLOCK_BINDING, node);
+            node = right;
+         }
+      }
+      scope->color = GC_NONE;
+      scope->count = 0;
+      PutFree(context, BLOCK_SCOPE, scope);
+   }
+}
+
+void CollectCycles(JLContext *context)
+{
+   MarkStack stack;
+   size_t items;
+
+   if(context->collecting) {
+      return;
+   }
+   context->collecting = 1;
+   stack.context = context;
+   stack.items = NULL;
+   stack.count = 0;
+   stack.max_count = 0;
+   stack.live = 0;
+   stack.failed = 0;
+
+   /* Every allocated value and scope starts out as a candidate. */
+   ForEachItem(context, BLOCK_VALUE, PrepareValue, NULL);
+   ForEachItem(context, BLOCK_SCOPE, PrepareScope, NULL);
+
+   /* Remove references held within the heap from the counts. */
+   ForEachItem(context, BLOCK_VALUE, SubtractValue, &stack);
+   ForEachItem(context, BLOCK_SCOPE, SubtractScope, &stack);
+
+   /* Mark everything reachable from nodes still referenced. */
+   ForEachItem(context, BLOCK_VALUE, MarkValue, &stack);
+   ForEachItem(context, BLOCK_SCOPE, MarkScope, &stack);
+
+   /* If the stack could not grow, some live nodes were not reached, so
+    * everything is kept. */
+   if(stack.failed) {
+      ForEachItem(context, BLOCK_VALUE, KeepValue, NULL);
+      ForEachItem(context, BLOCK_SCOPE, KeepScope, NULL);
+   }
+
+   /* Add back the references held by live nodes.  References held by
+    * garbage are not restored, which releases them. */
+   ForEachItem(context, BLOCK_VALUE, RestoreValue, &stack);
+   ForEachItem(context, BLOCK_SCOPE, RestoreScope, &stack);
+
+   /* Free whatever was not reached. */
+   ForEachItem(context, BLOCK_VALUE, SweepValue, NULL);
+   ForEachItem(context, BLOCK_SCOPE, SweepScope, NULL);
+
+   FreeMemory(context, stack.items, stack.max_count * sizeof(uintptr_t));
+
+   /* Allow the heap to grow by the amount of live data before the
+    * next collection so that the cost is amortized. */
+   items = stack.live;
+   if(items < GC_MIN_ITEMS) {
+      items = GC_MIN_ITEMS;
+   }
+   context->gc_items = items + context->slabs[BLOCK_VALUE].item_count
+                     + context->slabs[BLOCK_SCOPE].item_count;
+   context->collecting = 0;
+}
+
+void FreeRemaining(JLContext *context)
+{
+   /* Everything still allocated when a context is destroyed is garbage,
+    * including anything the collector could not free for lack of
+    * memory. */
+   context->collecting = 1;
+   ForEachItem(context, BLOCK_VALUE, PrepareValue, NULL);
+   ForEachItem(context, BLOCK_SCOPE, PrepareScope, NULL);
+   ForEachItem(context, BLOCK_VALUE, SweepValue, NULL);
+   ForEachItem(context, BLOCK_SCOPE, SweepScope, NULL);
+}
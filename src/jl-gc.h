@@ -0,0 +1,23 @@
+/**
+ * @file jl-gc.h
+ * @author Joe Wingbermuehle
+ *
+ * Collector for reference cycles.
+ *
+ */
+
+#ifndef JL_GC_H
+#define JL_GC_H
+
+struct JLContext;
+
+/** Collector colors for values and scopes. */
+#define GC_NONE         0     /**< Not being collected. */
+#define GC_CANDIDATE    1     /**< Possibly garbage. */
+#define GC_LIVE         2     /**< Known to be reachable. */
+
+void CollectCycles(struct JLContext *context);
+
+void FreeRemaining(struct JLContext *context);
+
+#endif /* JL_GC_H */
@@ -0,0 +1,94 @@
+/**
+ * @file jl-hash.c
+ * @author Joe Wingbermuehle
+ *
+ * Generates src/jl-builtins.h, the perfect hash table of the builtins.
+ * Seeds are tried in order from the FNV offset basis until every builtin
+ * name has its own slot.  Run "make builtins" after adding or renaming a
+ * builtin; "make check" fails while the table is out of date.
+ *
+ */
+
+#include "jl-func.h"
+
+#include <stdio.h>
+
+/** The FNV-1a offset basis, where the search starts. */
+#define FIRST_SEED      0x811c9dc5u
+
+static char TrySeed(uint32_t seed, unsigned char *table);
+static void PrintTable(uint32_t seed, const unsigned char *table);
+
+char TrySeed(uint32_t seed, unsigned char *table)
+{
+   /* Returns 1 if every name has its own slot with this seed. */
+   const char *name;
+   size_t i;
+   for(i = 0; i < BUILTIN_SLOTS; i++) {
+      table[i] = 0;
+   }
+   for(i = 0; (name = GetBuiltinName(i)) != NULL; i++) {
+      const unsigned int slot = HashBuiltin(name, seed);
+      if(table[slot] != 0) {
+         return 0;
+      }
+      table[slot] = (unsigned char)(i + 1);
+   }
+   return 1;
+}
+
+void PrintTable(uint32_t seed, const unsigned char *table)
+{
+   size_t i;
+   printf("/**\n");
+   printf(" * @file jl-builtins.h\n");
+   printf(" *\n");
+   printf(" * Perfect hash table of the builtins in jl-func.c."
+          "  This file is\n");
+   printf(" * generated by jl-hash: run \"make builtins\" after adding or"
+          " renaming\n");
+   printf(" * a builtin.\n");
+   printf(" *\n");
+   printf(" */\n\n");
+   printf("#ifndef JL_BUILTINS_H\n");
+   printf("#define JL_BUILTINS_H\n\n");
+   printf("#include \"jl-func.h\"\n\n");
+   printf("/** Hash seed for which every builtin has its own slot. */\n");
+   printf("#define BUILTIN_SEED    0x%08lxu\n\n", (unsigned long)seed);
+   printf("/** Index + 1 of the builtin in each slot of the hash table. */\n");
+   printf("static const unsigned char BUILTIN_TABLE[BUILTIN_SLOTS] = {\n");
+   for(i = 0; i < BUILTIN_SLOTS; i++) {
+      const char *sep = (i + 1) % 16 == 0
+                      ? (i + 1 < BUILTIN_SLOTS ? ",\n" : "\n") : ", ";
+      printf("%s%2u%s", i % 16 == 0 ? "   " : "", table[i], sep);
+   }
+   printf("};\n\n");
+   printf("#endif /* JL_BUILTINS_H */\n");
+}
+
+int main(int argc, char *argv[])
+{
+   unsigned char table[BUILTIN_SLOTS];
+   uint32_t seed = FIRST_SEED;
+   size_t count = 0;
+
+   while(GetBuiltinName(count) != NULL) {
+      count += 1;
+   }
+   if(count >= BUILTIN_SLOTS) {
+      fprintf(stderr, "jl-hash: too many builtins for %u slots\n",
+              BUILTIN_SLOTS);
+      return 1;
+   }
+
+   do {
+      if(TrySeed(seed, table)) {
+         PrintTable(seed, table);
+         return 0;
+      }
+      seed += 1;
+   } while(seed != FIRST_SEED);
+
+   fprintf(stderr, "jl-hash: no seed found\n");
+   return 1;
+}
@@ -0,0 +1,729 @@
+/**
+ * @file jl-image.c
+ * @author Joe Wingbermuehle
+ *
+ * Images hold every value and scope reachable from the current scope of
+ * a context so that an initialized environment can be restored without
+ * evaluating anything.
+ *
+ * Values and scopes are numbered in the order they are found.  An image
+ * starts with a header holding the number of values and scopes, followed
+ * by a record for each in the same order.  References are written as
+ * (id * 2 + is_scope) + 1 with 0 for NULL, so the image does not depend
+ * on where it was loaded.
+ *
+ * Value record: tag, payload, reference to the next value.
+ * Scope record: IMAGE_SCOPE, reference to the parent, the number of
+ * bindings, then the name and value reference of each binding in
+ * level order.
+ *
+ */
+
+#include "jl-file.h"
+#include "jl-context.h"
+#include "jl-value.h"
+#include "jl-scope.h"
+#include "jl-func.h"
+#include "jl-gc.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+/** Image file format version. */
+#define IMAGE_FORMAT    2
+
+/** Value used to detect files written with a different byte order. */
+#define IMAGE_CHECK     0x01020304
+
+/** Tag of scope records. */
+#define IMAGE_SCOPE     ((char)0x80)
+
+/** Header of an image file. */
+typedef struct ImageHeader {
+   char magic[4];
+   uint8_t format;
+   uint8_t version_major;
+   uint8_t version_minor;
+   uint8_t reserved;
+   uint32_t check;
+   uint64_t value_count;
+   uint64_t scope_count;
+} ImageHeader;
+
+/** Value or scope found while saving an image. */
+typedef struct ImageEntry {
+   uintptr_t key;          /**< Address, low bit set for scopes. */
+   size_t id;
+} ImageEntry;
+
+/** State for saving an image. */
+typedef struct ImageWriter {
+   FileWriter file;
+   ImageEntry *table;      /**< Open addressing table of entries. */
+   size_t table_size;
+   uintptr_t *queue;       /**< Entries in the order found. */
+   size_t queue_len;
+   size_t queue_max;
+   size_t value_count;
+   size_t scope_count;
+   BindingNode **bindings; /**< Bindings of the scope being written. */
+   size_t binding_max;
+} ImageWriter;
+
+/** State for loading an image. */
+typedef struct ImageReader {
+   JLContext *context;
+   const char *data;
+   const char *end;
+   JLValue **values;
+   ScopeNode **scopes;
+   size_t value_count;
+   size_t scope_count;
+} ImageReader;
+
+static void InitImageHeader(ImageHeader *header);
+static size_t HashKey(uintptr_t key, size_t size);
+static void GrowTable(ImageWriter *writer);
+static size_t AddEntry(ImageWriter *writer, uintptr_t key);
+static void WriteRef(ImageWriter *writer, const void *ptr, char is_scope);
+static void WriteImageValue(ImageWriter *writer, const JLValue *value);
+static void WriteImageScope(ImageWriter *writer, const ScopeNode *scope);
+static char ReadRef(ImageReader *reader, char is_scope, void **result);
+static char ReadImageValue(ImageReader *reader, JLValue *value, char tag);
+static char ReadImageScope(ImageReader *reader, ScopeNode *scope);
+static char InsertBinding(ImageReader *reader, ScopeNode *scope,
+                          char *name, JLValue *value);
+static char ReadImage(ImageReader *reader);
+static char CheckScopes(ImageReader *reader);
+static void DiscardImage(ImageReader *reader);
+
+void InitImageHeader(ImageHeader *header)
+{
+   memset(header, 0, sizeof(ImageHeader));
+   memcpy(header->magic, "JLI", 4);
+   header->format = IMAGE_FORMAT;
+   header->version_major = JL_VERSION_MAJOR;
+   header->version_minor = JL_VERSION_MINOR;
+   header->check = IMAGE_CHECK;
+}
+
+size_t HashKey(uintptr_t key, size_t size)
+{
+   /* Mix the bits since nearby items differ only in a few bits. */
+   uint64_t hash = (uint64_t)key;
+   hash ^= hash >> 33;
+   hash *= 0xff51afd7ed558ccdULL;
+   hash ^= hash >> 33;
+   return (size_t)hash & (size - 1);
+}
+
+void GrowTable(ImageWriter *writer)
+{
+   JLContext *context = writer->file.context;
+   ImageEntry *old_table = writer->table;
+   const size_t old_size = writer->table_size;
+   const size_t new_size = old_size ? old_size * 2 : 1024;
+   ImageEntry *new_table;
+   size_t i;
+
+   new_table = (ImageEntry*)AllocMemory(context,
+                                        new_size * sizeof(ImageEntry));
+   if(new_table == NULL) {
+      writer->file.failed = 1;
+      return;
+   }
+   writer->table = new_table;
+   writer->table_size = new_size;
+   memset(writer->table, 0, writer->table_size * sizeof(ImageEntry));
+   for(i = 0; i < old_size; i++) {
+      if(old_table[i].key) {
+         size_t index = HashKey(old_table[i].key, writer->table_size);
+         while(writer->table[index].key) {
+            index = (index + 1) & (writer->table_size - 1);
+         }
+         writer->table[index] = old_table[i];
+      }
+   }
+   FreeMemory(context, old_table, old_size * sizeof(ImageEntry));
+}
+
+size_t AddEntry(ImageWriter *writer, uintptr_t key)
+{
+   /* Look up the id of a value or scope, adding it to the queue if it
+    * has not been seen. */
+   JLContext *context = writer->file.context;
+   size_t index;
+
+   if(writer->queue_len * 2 >= writer->table_size) {
+      GrowTable(writer);
+   }
+   if(writer->file.failed) {
+      return 0;
+   }
+   index = HashKey(key, writer->table_size);
+   while(writer->table[index].key) {
+      if(writer->table[index].key == key) {
+         return writer->table[index].id;
+      }
+      index = (index + 1) & (writer->table_size - 1);
+   }
+
+   if(writer->queue_len == writer->queue_max) {
+      const size_t old_max = writer->queue_max;
+      const size_t new_max = old_max ? old_max * 2 : 1024;
+      uintptr_t *queue = (uintptr_t*)ReallocMemory(context, writer->queue,
+                                        old_max * sizeof(uintptr_t),
+                                        new_max * sizeof(uintptr_t));
+      if(queue == NULL) {
+         writer->file.failed = 1;
+         return 0;
+      }
+      writer->queue = queue;
+      writer->queue_max = new_max;
+   }
+   writer->table[index].key = key;
+   if(key & 1) {
+      writer->table[index].id = writer->scope_count++;
+   } else {
+      writer->table[index].id = writer->value_count++;
+   }
+   writer->queue[writer->queue_len++] = key;
+   return writer->table[index].id;
+}
+
+void WriteRef(ImageWriter *writer, const void *ptr, char is_scope)
+{
+   if(ptr) {
+      const size_t id = AddEntry(writer, (uintptr_t)ptr | is_scope);
+      WriteLength(&writer->file, id * 2 + is_scope + 1);
+   } else {
+      WriteLength(&writer->file, 0);
+   }
+}
+
+void WriteImageValue(ImageWriter *writer, const JLValue *value)
+{
+   /* Host data cannot be saved.  User data and functions other than
+    * the builtins are saved as nil. */
+   const char *name = NULL;
+   char tag = value->tag;
+   if(tag == JLVALUE_SPECIAL) {
+      if(value->value.special->extra == NULL) {
+         name = GetFunctionName(value->value.special->func);
+      }
+      if(name == NULL) {
+         tag = JLVALUE_NIL;
+      }
+   } else if(tag == JLVALUE_NATIVE) {
+      if(value->value.native->extra == NULL) {
+         name = GetNativeName(value->value.native->func);
+      }
+      if(name == NULL) {
+         tag = JLVALUE_NIL;
+      }
+   } else if(tag == JLVALUE_USERDATA) {
+      tag = JLVALUE_NIL;
+   }
+
+   WriteData(&writer->file, &tag, 1);
+   switch(tag) {
+   case JLVALUE_NUMBER:
+      WriteData(&writer->file, &value->value.number, sizeof(double));
+      break;
+   case JLVALUE_STRING:
+   case JLVALUE_VARIABLE:
+      WriteString(&writer->file, value->value.str);
+      break;
+   case JLVALUE_LIST:
+   case JLVALUE_LAMBDA:
+      WriteRef(writer, value->value.lst, 0);
+      break;
+   case JLVALUE_SCOPE:
+      WriteRef(writer, value->value.scope, 1);
+      break;
+   case JLVALUE_SPECIAL:
+   case JLVALUE_NATIVE:
+      WriteString(&writer->file, name);
+      break;
+   default:
+      break;
+   }
+   WriteRef(writer, value->next, 0);
+}
+
+void WriteImageScope(ImageWriter *writer, const ScopeNode *scope)
+{
+   /* Bindings are written in level order, using the array as the queue.
+    * Inserting them in the same order rebuilds the same tree. */
+   JLContext *context = writer->file.context;
+   const char tag = IMAGE_SCOPE;
+   size_t count = 0;
+   size_t i;
+
+   if(scope->bindings) {
+      writer->bindings[count++] = scope->bindings;
+   }
+   for(i = 0; i < count; i++) {
+      const BindingNode *binding = writer->bindings[i];
+      if(count + 2 > writer->binding_max) {
+         const size_t old_max = writer->binding_max;
+         BindingNode **bindings = (BindingNode**)ReallocMemory(context,
+                                     writer->bindings,
+                                     old_max * sizeof(BindingNode*),
+                                     old_max * 2 * sizeof(BindingNode*));
+         if(bindings == NULL) {
+            writer->file.failed = 1;
+            return;
+         }
+         writer->bindings = bindings;
+         writer->binding_max = old_max * 2;
+      }
+      if(binding->left) {
+         writer->bindings[count++] = binding->left;
+      }
+      if(binding->right) {
+         writer->bindings[count++] = binding->right;
+      }
+   }
+
+   WriteData(&writer->file, &tag, 1);
+   WriteRef(writer, scope->next, 1);
+   WriteLength(&writer->file, count);
+   for(i = 0; i < count; i++) {
+      WriteString(&writer->file, writer->bindings[i]->name);
+      WriteRef(writer, writer->bindings[i]->value, 0);
+   }
+}
+
+char ReadRef(ImageReader *reader, char is_scope, void **result)
+{
+   size_t ref;
+   if(!ReadLength(&reader->data, reader->end, &ref)) {
+      return 0;
+   }
+   if(ref == 0) {
+      *result = NULL;
+      return 1;
+   }
+   ref -= 1;
+   if((ref & 1) != (size_t)is_scope) {
+      return 0;
+   }
+   ref >>= 1;
+   if(is_scope) {
+      if(ref >= reader->scope_count) {
+         return 0;
+      }
+      reader->scopes[ref]->count += 1;
+      *result = reader->scopes[ref];
+   } else {
+      if(ref >= reader->value_count) {
+         return 0;
+      }
+      reader->values[ref]->count += 1;
+      *result = reader->values[ref];
+   }
+   return 1;
+}
+
+char ReadImageValue(ImageReader *reader, JLValue *value, char tag)
+{
+   JLContext *context = reader->context;
+   size_t len;
+   char *name;
+
+   switch(tag) {
+   case JLVALUE_NIL:
+      break;
+   case JLVALUE_NUMBER:
+      if(reader->end - reader->data < (ptrdiff_t)sizeof(double)) {
+         return 0;
+      }
+      memcpy(&value->value.number, reader->data, sizeof(double));
+      reader->data += sizeof(double);
+      break;
+   case JLVALUE_STRING:
+   case JLVALUE_VARIABLE:
+   case JLVALUE_SPECIAL:
+   case JLVALUE_NATIVE:
+      if(!ReadLength(&reader->data, reader->end, &len) ||
+         len > (size_t)(reader->end - reader->data)) {
+         return 0;
+      }
+      name = AllocString(context, len + 1);
+      if(name == NULL) {
+         return 0;
+      }
+      memcpy(name, reader->data, len);
+      name[len] = 0;
+      reader->data += len;
+      if(tag == JLVALUE_SPECIAL) {
+         const JLFunction func = GetFunction(name);
+         FreeString(context, name);
+         if(func == NULL) {
+            return 0;
+         }
+         value->value.special = (SpecialFunction*)GetFree(context,
+                                                          BLOCK_NODE);
+         if(value->value.special == NULL) {
+            return 0;
+         }
+         value->value.special->func = func;
+         value->value.special->extra = NULL;
+      } else if(tag == JLVALUE_NATIVE) {
+         NativeFunction native;
+         const char found = GetNative(name, &native);
+         FreeString(context, name);
+         if(!found) {
+            return 0;
+         }
+         value->value.native = (NativeFunction*)GetFree(context,
+                                                        BLOCK_NODE);
+         if(value->value.native == NULL) {
+            return 0;
+         }
+         *value->value.native = native;
+      } else {
+         value->value.str = name;
+      }
+      break;
+   case JLVALUE_LIST:
+   case JLVALUE_LAMBDA:
+      if(!ReadRef(reader, 0, (void**)&value->value.lst)) {
+         return 0;
+      }
+      break;
+   case JLVALUE_SCOPE:
+      if(!ReadRef(reader, 1, &value->value.scope) || !value->value.scope) {
+         return 0;
+      }
+      break;
+   default:
+      return 0;
+   }
+   value->tag = tag;
+   return ReadRef(reader, 0, (void**)&value->next);
+}
+
+char InsertBinding(ImageReader *reader, ScopeNode *scope,
+                   char *name, JLValue *value)
+{
+   BindingNode **root = &scope->bindings;
+   while(*root) {
+      const int v = strcmp((*root)->name, name);
+      if(v < 0) {
+         root = &(*root)->left;
+      } else if(v > 0) {
+         root = &(*root)->right;
+      } else {
+         return 0;
+      }
+   }
+   *root = (BindingNode*)GetFree(reader->context, BLOCK_BINDING);
+   if(*root == NULL) {
+      return 0;
+   }
+   (*root)->name = name;
+   (*root)->value = value;
+   (*root)->left = NULL;
+   (*root)->right = NULL;
+   return 1;
+}
+
+char ReadImageScope(ImageReader *reader, ScopeNode *scope)
+{
+   JLContext *context = reader->context;
+   size_t count;
+   size_t i;
+
+   if(!ReadRef(reader, 1, (void**)&scope->next) ||
+      !ReadLength(&reader->data, reader->end, &count)) {
+      return 0;
+   }
+   for(i = 0; i < count; i++) {
+      JLValue *value;
+      size_t len;
+      char *name;
+      if(!ReadLength(&reader->data, reader->end, &len) ||
+         len > (size_t)(reader->end - reader->data)) {
+         return 0;
+      }
+      name = AllocString(context, len + 1);
+      if(name == NULL) {
+         return 0;
+      }
+      memcpy(name, reader->data, len);
+      name[len] = 0;
+      reader->data += len;
+      if(!ReadRef(reader, 0, (void**)&value)) {
+         FreeString(context, name);
+         return 0;
+      }
+      if(!InsertBinding(reader, scope, name, value)) {
+         FreeString(context, name);
+         return 0;
+      }
+   }
+   return 1;
+}
+
+char ReadImage(ImageReader *reader)
+{
+   /* Every value and scope is created first so that references can be
+    * resolved as each record is read.  Counts start at zero and are
+    * incremented for each reference. */
+   JLContext *context = reader->context;
+   size_t value_index = 0;
+   size_t scope_index = 0;
+   size_t i;
+
+   /* The arrays are cleared first so that a partly created image can be
+    * discarded. */
+   reader->values = NULL;
+   if(reader->value_count > 0) {
+      reader->values = (JLValue**)AllocMemory(context,
+                           reader->value_count * sizeof(JLValue*));
+      if(reader->values == NULL) {
+         reader->value_count = 0;
+         reader->scope_count = 0;
+         reader->scopes = NULL;
+         return 0;
+      }
+      memset(reader->values, 0, reader->value_count * sizeof(JLValue*));
+   }
+   reader->scopes = (ScopeNode**)AllocMemory(context,
+                        reader->scope_count * sizeof(ScopeNode*));
+   if(reader->scopes == NULL) {
+      reader->scope_count = 0;
+      return 0;
+   }
+   memset(reader->scopes, 0, reader->scope_count * sizeof(ScopeNode*));
+   for(i = 0; i < reader->value_count; i++) {
+      reader->values[i] = CreateValue(context, NULL, JLVALUE_NIL);
+      if(reader->values[i] == NULL) {
+         return 0;
+      }
+      reader->values[i]->count = 0;
+   }
+   for(i = 0; i < reader->scope_count; i++) {
+      ScopeNode *scope = (ScopeNode*)GetFree(context, BLOCK_SCOPE);
+      if(scope == NULL) {
+         return 0;
+      }
+      scope->bindings = NULL;
+      scope->next = NULL;
+      scope->count = 0;
+      scope->color = GC_NONE;
+      reader->scopes[i] = scope;
+   }
+
+   while(reader->data < reader->end) {
+      const char tag = *reader->data++;
+      if(tag == IMAGE_SCOPE) {
+         if(scope_index >= reader->scope_count ||
+            !ReadImageScope(reader, reader->scopes[scope_index])) {
+            return 0;
+         }
+         scope_index += 1;
+      } else {
+         if(value_index >= reader->value_count ||
+            !ReadImageValue(reader, reader->values[value_index], tag)) {
+            return 0;
+         }
+         value_index += 1;
+      }
+   }
+   if(value_index != reader->value_count
+      || scope_index != reader->scope_count) {
+      return 0;
+   }
+
+   /* Everything other than the first scope was found through a
+    * reference, so anything unreferenced means the image is damaged. */
+   for(i = 0; i < reader->value_count; i++) {
+      if(reader->values[i]->count == 0) {
+         return 0;
+      }
+   }
+   for(i = 1; i < reader->scope_count; i++) {
+      if(reader->scopes[i]->count == 0) {
+         return 0;
+      }
+   }
+   return CheckScopes(reader);
+}
+
+char CheckScopes(ImageReader *reader)
+{
+   /* Make sure that no scope is its own ancestor.  Scopes on the path
+    * being followed are candidates and scopes known to reach the root
+    * are live. */
+   char result = 1;
+   size_t i;
+   for(i = 0; i < reader->scope_count && result; i++) {
+      ScopeNode *scope = reader->scopes[i];
+      ScopeNode *node;
+      while(scope && scope->color == GC_NONE) {
+         scope->color = GC_CANDIDATE;
+         scope = scope->next;
+      }
+      if(scope && scope->color == GC_CANDIDATE) {
+         result = 0;
+      }
+      for(node = reader->scopes[i]; node != scope; node = node->next) {
+         node->color = GC_LIVE;
+      }
+   }
+   for(i = 0; i < reader->scope_count; i++) {
+      reader->scopes[i]->color = GC_NONE;
+   }
+   return result;
+}
+
+void DiscardImage(ImageReader *reader)
+{
+   /* Free the strings of a partly loaded image.  Everything else is
+    * freed with the blocks of the context. */
+   JLContext *context = reader->context;
+   size_t i;
+   for(i = 0; i < reader->value_count && reader->values[i]; i++) {
+      JLValue *value = reader->values[i];
+      if(value->tag == JLVALUE_STRING || value->tag == JLVALUE_VARIABLE) {
+         FreeString(context, value->value.str);
+      }
+   }
+   for(i = 0; i < reader->scope_count && reader->scopes[i]; i++) {
+      BindingNode *binding = reader->scopes[i]->bindings;
+      while(binding) {
+         /* Rotate right to walk the tree without recursion. */
+         if(binding->left) {
+            BindingNode *left = binding->left;
+            binding->left = left->right;
+            left->right = binding;
+            binding = left;
+         } else {
+            FreeString(context, binding->name);
+            binding = binding->right;
+         }
+      }
+   }
+}
+
+char JLSaveImage(JLContext *context, const char *filename)
+{
+   ImageWriter writer;
+   ImageHeader header;
+   size_t i;
+   char result;
+
+   InitWriter(&writer.file, context);
+   writer.table = NULL;
+   writer.table_size = 0;
+   writer.queue = NULL;
+   writer.queue_len = 0;
+   writer.queue_max = 0;
+   writer.value_count = 0;
+   writer.scope_count = 0;
+   writer.binding_max = 256;
+   writer.bindings = (BindingNode**)AllocMemory(context,
+                        writer.binding_max * sizeof(BindingNode*));
+   if(writer.bindings == NULL) {
+      writer.binding_max = 0;
+      writer.file.failed = 1;
+   }
+
+   InitImageHeader(&header);
+   WriteData(&writer.file, &header, sizeof(header));
+   AddEntry(&writer, (uintptr_t)context->scope | 1);
+   for(i = 0; i < writer.queue_len && !writer.file.failed; i++) {
+      const uintptr_t key = writer.queue[i];
+      if(key & 1) {
+         WriteImageScope(&writer, (const ScopeNode*)(key & ~(uintptr_t)1));
+      } else {
+         WriteImageValue(&writer, (const JLValue*)key);
+      }
+   }
+
+   /* Fill in the counts now that they are known. */
+   header.value_count = writer.value_count;
+   header.scope_count = writer.scope_count;
+   if(!writer.file.failed) {
+      memcpy(writer.file.data, &header, sizeof(header));
+   }
+
+   FreeMemory(context, writer.table, writer.table_size * sizeof(ImageEntry));
+   FreeMemory(context, writer.queue, writer.queue_max * sizeof(uintptr_t));
+   FreeMemory(context, writer.bindings,
+              writer.binding_max * sizeof(BindingNode*));
+   result = SaveWriter(&writer.file, filename);
+   if(!result) {
+      Error(context, "could not write %s", filename);
+   }
+   return result;
+}
+
+JLContext *JLLoadImage(const char *filename)
+{
+   JLContext *context = AllocContext(NULL, NULL, NULL, NULL);
+   ImageReader reader;
+   ImageHeader header;
+   ImageHeader expected;
+   MappedFile file;
+   char loaded = 0;
+
+   if(context == NULL) {
+      return NULL;
+   }
+   if(!MapFile(context, filename, &file)) {
+      Error(context, "could not open %s", filename);
+      FreeContext(context);
+      return NULL;
+   }
+
+   InitImageHeader(&expected);
+   if(file.size >= sizeof(ImageHeader)) {
+      memcpy(&header, file.data, sizeof(ImageHeader));
+      expected.value_count = header.value_count;
+      expected.scope_count = header.scope_count;
+   }
+   if(file.size >= sizeof(ImageHeader) &&
+      !memcmp(&header, &expected, sizeof(ImageHeader)) &&
+      header.scope_count > 0 &&
+      header.value_count + header.scope_count
+         <= (file.size - sizeof(ImageHeader)) / 2) {
+      reader.context = context;
+      reader.data = file.data + sizeof(ImageHeader);
+      reader.end = file.data + file.size;
+      reader.value_count = (size_t)header.value_count;
+      reader.scope_count = (size_t)header.scope_count;
+
+      /* The collector must not run while the counts are incomplete. */
+      context->collecting = 1;
+      loaded = ReadImage(&reader);
+      context->collecting = 0;
+      if(loaded) {
+         /* The first scope is the current scope of the context.  The
+          * context holds a reference to it and each of its parents. */
+         ScopeNode *scope;
+         context->scope = reader.scopes[0];
+         for(scope = context->scope; scope; scope = scope->next) {
+            scope->count += 1;
+         }
+      } else {
+         DiscardImage(&reader);
+      }
+      FreeMemory(context, reader.values,
+                 reader.value_count * sizeof(JLValue*));
+      FreeMemory(context, reader.scopes,
+                 reader.scope_count * sizeof(ScopeNode*));
+   }
+   UnmapFile(context, &file);
+
+   if(!loaded) {
+      Error(context, "invalid image: %s", filename);
+      FreeContext(context);
+      return NULL;
+   }
+   return context;
+}
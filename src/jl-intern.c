@@ -0,0 +1,225 @@
+/**
+ * @file jl-intern.c
+ * @author Joe Wingbermuehle
+ */
+
+#include "jl-intern.h"
+#include "jl-context.h"
+#include "jl-value.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define INITIAL_TABLE_SIZE 256
+
+/** A list being interned. */
+typedef struct InternFrame {
+   JLValue *reversed;      /**< Items left to intern, last first. */
+   JLValue *result;        /**< Interned items so far. */
+} InternFrame;
+
+static size_t HashValue(const JLValue *value);
+static char IsEqual(const JLValue *a, const JLValue *b);
+static void GrowTable(JLContext *context);
+static JLValue *InternCell(JLContext *context, JLValue *value);
+static JLValue *ReverseList(JLValue *value);
+static char GrowStack(JLContext *context, InternFrame **stack,
+                      size_t depth, size_t *max_depth);
+
+size_t HashValue(const JLValue *value)
+{
+   size_t hash = (size_t)value->tag * 31 + ((size_t)value->next >> 4);
+   const char *ch;
+   uint64_t bits;
+   switch(value->tag) {
+   case JLVALUE_NUMBER:
+      memcpy(&bits, &value->value.number, sizeof(bits));
+      hash = hash * 31 + (size_t)(bits ^ (bits >> 32));
+      break;
+   case JLVALUE_STRING:
+   case JLVALUE_VARIABLE:
+      for(ch = value->value.str; *ch; ch++) {
+         hash = (hash ^ (unsigned char)*ch) * 16777619;
+      }
+      break;
+   case JLVALUE_LIST:
+      hash = hash * 31 + ((size_t)value->value.lst >> 4);
+      break;
+   default:
+      break;
+   }
+   return hash;
+}
+
+char IsEqual(const JLValue *a, const JLValue *b)
+{
+   if(a->tag != b->tag || a->next != b->next) {
+      return 0;
+   }
+   switch(a->tag) {
+   case JLVALUE_NUMBER:
+      /* Compare the representation so that -0 and 0 stay distinct. */
+      return !memcmp(&a->value.number, &b->value.number, sizeof(double));
+   case JLVALUE_STRING:
+   case JLVALUE_VARIABLE:
+      return !strcmp(a->value.str, b->value.str);
+   case JLVALUE_LIST:
+      return a->value.lst == b->value.lst;
+   default:
+      return 0;
+   }
+}
+
+void GrowTable(JLContext *context)
+{
+   const size_t old_size = context->intern_size;
+   const size_t new_size = old_size ? old_size * 2 : INITIAL_TABLE_SIZE;
+   InternNode **old_table = context->intern_table;
+   InternNode **new_table;
+   size_t i;
+
+   /* The old table is kept if there is no memory for a larger one. */
+   new_table = (InternNode**)AllocMemory(context,
+                                         new_size * sizeof(InternNode*));
+   if(new_table == NULL) {
+      return;
+   }
+   context->intern_size = new_size;
+   context->intern_table = new_table;
+   memset(context->intern_table, 0,
+          context->intern_size * sizeof(InternNode*));
+   for(i = 0; i < old_size; i++) {
+      InternNode *node = old_table[i];
+      while(node) {
+         InternNode *next = node->next;
+         const size_t index = node->hash & (context->intern_size - 1);
+         node->next = context->intern_table[index];
+         context->intern_table[index] = node;
+         node = next;
+      }
+   }
+   FreeMemory(context, old_table, old_size * sizeof(InternNode*));
+}
+
+JLValue *InternCell(JLContext *context, JLValue *value)
+{
+   const size_t hash = HashValue(value);
+   InternNode *node;
+   size_t index;
+
+   if(context->intern_count >= context->intern_size) {
+      GrowTable(context);
+      if(context->intern_size == 0) {
+         return value;
+      }
+   }
+   index = hash & (context->intern_size - 1);
+   for(node = context->intern_table[index]; node; node = node->next) {
+      if(node->hash == hash && IsEqual(node->value, value)) {
+         JLRetain(context, node->value);
+         JLRelease(context, value);
+         return node->value;
+      }
+   }
+
+   /* Values that cannot be added are simply left unshared. */
+   node = (InternNode*)GetFree(context, BLOCK_NODE);
+   if(node == NULL) {
+      return value;
+   }
+   node->value = value;
+   node->hash = hash;
+   node->next = context->intern_table[index];
+   context->intern_table[index] = node;
+   context->intern_count += 1;
+   value->flags |= JLFLAG_INTERNED;
+   return value;
+}
+
+JLValue *ReverseList(JLValue *value)
+{
+   JLValue *result = NULL;
+   while(value) {
+      JLValue *next = value->next;
+      value->next = result;
+      result = value;
+      value = next;
+   }
+   return result;
+}
+
+char GrowStack(JLContext *context, InternFrame **stack,
+               size_t depth, size_t *max_depth)
+{
+   /* Make room for one more frame.  Returns 0 if out of memory. */
+   if(depth == *max_depth) {
+      const size_t new_depth = depth ? depth * 2 : 16;
+      InternFrame *temp = (InternFrame*)ReallocMemory(context, *stack,
+                                           depth * sizeof(InternFrame),
+                                           new_depth * sizeof(InternFrame));
+      if(temp == NULL) {
+         return 0;
+      }
+      *stack = temp;
+      *max_depth = new_depth;
+   }
+   return 1;
+}
+
+JLValue *InternTree(JLContext *context, JLValue *value)
+{
+   /* Each list is reversed so that each tail is interned before the
+    * items that refer to it.  Identical subtrees then end up with
+    * identical child pointers, making the comparison for each item
+    * shallow.  Nested lists are handled with an explicit stack; a list
+    * that does not fit on the stack is left as it is. */
+   InternFrame *stack = NULL;
+   size_t depth = 0;
+   size_t max_depth = 0;
+   InternFrame frame;
+
+   frame.reversed = ReverseList(value);
+   frame.result = NULL;
+   for(;;) {
+      JLValue *item = frame.reversed;
+      if(item == NULL) {
+         if(depth == 0) {
+            break;
+         }
+
+         /* Finished a nested list; return to its parent. */
+         value = frame.result;
+         frame = stack[--depth];
+         frame.reversed->value.lst = value;
+         item = frame.reversed;
+      } else if(item->tag == JLVALUE_LIST && item->value.lst
+                && GrowStack(context, &stack, depth, &max_depth)) {
+         stack[depth++] = frame;
+         frame.reversed = ReverseList(item->value.lst);
+         frame.result = NULL;
+         continue;
+      }
+      frame.reversed = item->next;
+      item->next = frame.result;
+      frame.result = InternCell(context, item);
+   }
+   FreeMemory(context, stack, max_depth * sizeof(InternFrame));
+   return frame.result;
+}
+
+void RemoveInterned(JLContext *context, JLValue *value)
+{
+   const size_t index = HashValue(value) & (context->intern_size - 1);
+   InternNode **node = &context->intern_table[index];
+   while(*node) {
+      if((*node)->value == value) {
+         InternNode *temp = *node;
+         *node = temp->next;
+         PutFree(context, BLOCK_NODE, temp);
+         context->intern_count -= 1;
+         return;
+      }
+      node = &(*node)->next;
+   }
+}
@@ -0,0 +1,27 @@
+/**
+ * @file jl-intern.h
+ * @author Joe Wingbermuehle
+ *
+ * Hash-consing of parsed values.
+ *
+ */
+
+#ifndef JL_INTERN_H
+#define JL_INTERN_H
+
+#include <stddef.h>
+
+struct JLContext;
+struct JLValue;
+
+typedef struct InternNode {
+   struct JLValue *value;
+   struct InternNode *next;
+   size_t hash;
+} InternNode;
+
+struct JLValue *InternTree(struct JLContext *context, struct JLValue *value);
+
+void RemoveInterned(struct JLContext *context, struct JLValue *value);
+
+#endif /* JL_INTERN_H */
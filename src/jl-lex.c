@@ -0,0 +1,380 @@
+/**
+ * @file jl-lex.c
+ * @author Joe Wingbermuehle
+ *
+ * Characters are classified with a table so that each byte is tested
+ * once.  Input ends at context->parse_end if set and at a NUL byte
+ * otherwise; NUL is a delimiter in every class, so the scanning loops
+ * only need to compare against the end when the input is bounded.
+ *
+ */
+
+#include "jl-lex.h"
+#include "jl-context.h"
+#include "jl-value.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/** Character classes. */
+#define CHAR_SPACE      0x01  /**< White-space. */
+#define CHAR_DELIM      0x02  /**< Ends a token. */
+#define CHAR_STRING     0x04  /**< Needs attention in a string. */
+#define CHAR_NUMBER     0x08  /**< May start a number. */
+#define CHAR_DIGIT      0x10  /**< Decimal digit. */
+
+#define IS_CLASS(ch, c) (CHAR_CLASSES[(unsigned char)(ch)] & (c))
+
+static const unsigned char CHAR_CLASSES[256] = {
+   [0]      = CHAR_DELIM | CHAR_STRING,
+   ['\t']   = CHAR_SPACE | CHAR_DELIM,
+   ['\n']   = CHAR_SPACE | CHAR_DELIM | CHAR_STRING,
+   ['\r']   = CHAR_SPACE | CHAR_DELIM,
+   [' ']    = CHAR_SPACE | CHAR_DELIM,
+   ['(']    = CHAR_DELIM,
+   [')']    = CHAR_DELIM,
+   [';']    = CHAR_DELIM,
+   ['\"']   = CHAR_STRING,
+   ['\\']   = CHAR_STRING,
+   ['+']    = CHAR_NUMBER,
+   ['-']    = CHAR_NUMBER,
+   ['.']    = CHAR_NUMBER,
+   ['0']    = CHAR_NUMBER | CHAR_DIGIT,
+   ['1']    = CHAR_NUMBER | CHAR_DIGIT,
+   ['2']    = CHAR_NUMBER | CHAR_DIGIT,
+   ['3']    = CHAR_NUMBER | CHAR_DIGIT,
+   ['4']    = CHAR_NUMBER | CHAR_DIGIT,
+   ['5']    = CHAR_NUMBER | CHAR_DIGIT,
+   ['6']    = CHAR_NUMBER | CHAR_DIGIT,
+   ['7']    = CHAR_NUMBER | CHAR_DIGIT,
+   ['8']    = CHAR_NUMBER | CHAR_DIGIT,
+   ['9']    = CHAR_NUMBER | CHAR_DIGIT,
+   ['i']    = CHAR_NUMBER,
+   ['I']    = CHAR_NUMBER,
+   ['n']    = CHAR_NUMBER,
+   ['N']    = CHAR_NUMBER
+};
+
+/** Powers of ten that are exactly representable as doubles. */
+static const double EXACT_POWERS[] = {
+   1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+   1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+   1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/** Results from ScanNumber. */
+#define NUMBER_NONE     0     /**< Not a number. */
+#define NUMBER_EXACT    1     /**< Parsed exactly. */
+#define NUMBER_SLOW     2     /**< Needs strtod. */
+
+static int HexValue(char ch);
+static char IsPrefix(const char *start, const char *end, const char *prefix);
+static char SpecialNumber(const char *start, const char *end);
+static char ScanNumber(const char *start, const char *end, double *result);
+static char SlowNumber(JLContext *context, const char *start,
+                       const char *end, double *result);
+static JLValue *ParseString(JLContext *context, const char **line);
+
+const char *SkipSpace(JLContext *context, const char *line)
+{
+   const char *end = context->parse_end;
+   while(line != end) {
+      if(IS_CLASS(*line, CHAR_SPACE)) {
+         context->line += *line == '\n';
+         line += 1;
+      } else if(*line == ';') {
+         const char *eol = end ? memchr(line, '\n', end - line)
+                               : strchr(line, '\n');
+         if(eol == NULL) {
+            return end ? end : line + strlen(line);
+         }
+         line = eol;
+      } else {
+         break;
+      }
+   }
+   return line;
+}
+
+int HexValue(char ch)
+{
+   if(ch >= '0' && ch <= '9') {
+      return ch - '0';
+   } else if(ch >= 'a' && ch <= 'f') {
+      return ch - 'a' + 10;
+   } else if(ch >= 'A' && ch <= 'F') {
+      return ch - 'A' + 10;
+   } else {
+      return -1;
+   }
+}
+
+JLValue *ParseString(JLContext *context, const char **line)
+{
+   /* Strings are C-style with escape sequences.  The first pass finds
+    * the end of the string to size the result, which can only shrink
+    * when escapes are decoded. */
+   const char *end = context->parse_end;
+   const char *start = *line + 1;
+   const char *p = start;
+   JLValue *result;
+   char *str;
+   size_t len = 0;
+
+   for(;;) {
+      while(p != end && !IS_CLASS(*p, CHAR_STRING)) {
+         p += 1;
+      }
+      if(p == end || *p == 0 || *p == '\"') {
+         break;
+      } else if(*p == '\\') {
+         p += 1;
+         if(p == end || *p == 0) {
+            break;
+         }
+      }
+      context->line += *p == '\n';
+      p += 1;
+   }
+
+   *line = p != end && *p == '\"' ? p + 1 : p;
+   str = AllocString(context, p - start + 1);
+   result = str ? CreateValue(context, NULL, JLVALUE_STRING) : NULL;
+   if(result == NULL) {
+      FreeString(context, str);
+      return NULL;
+   }
+   result->value.str = str;
+   end = p;
+   p = start;
+   while(p < end) {
+
+      /* Copy characters up to the next escape. */
+      const char *next = p;
+      while(next < end && *next != '\\') {
+         next += 1;
+      }
+      memcpy(&str[len], p, next - p);
+      len += next - p;
+      if(next + 1 >= end) {
+         break;
+      }
+
+      p = next + 2;
+      switch(next[1]) {
+      case 'a':   str[len++] = '\a';   break;
+      case 'b':   str[len++] = '\b';   break;
+      case 'f':   str[len++] = '\f';   break;
+      case 'n':   str[len++] = '\n';   break;
+      case 'r':   str[len++] = '\r';   break;
+      case 't':   str[len++] = '\t';   break;
+      case 'v':   str[len++] = '\v';   break;
+      case 'x':   /* Hex control sequence (up to 2 digits). */
+         if(p < end && HexValue(*p) >= 0) {
+            int value = HexValue(*p++);
+            if(p < end && HexValue(*p) >= 0) {
+               value = value * 16 + HexValue(*p++);
+            }
+            str[len++] = (char)value;
+         }
+         break;
+      case '0':   /* Octal control sequence (up to 3 digits). */
+         {
+            int value = 0;
+            int i;
+            for(i = 0; i < 3 && p < end && *p >= '0' && *p <= '7'; i++) {
+               value = value * 8 + (*p++ - '0');
+            }
+            str[len++] = (char)value;
+         }
+         break;
+      default:    /* Literal character */
+         str[len++] = next[1];
+         break;
+      }
+   }
+   str[len] = 0;
+   return result;
+}
+
+char IsPrefix(const char *start, const char *end, const char *prefix)
+{
+   /* Case-insensitive match of a lower-case prefix. */
+   while(*prefix) {
+      if(start == end || (*start | 0x20) != *prefix) {
+         return 0;
+      }
+      start += 1;
+      prefix += 1;
+   }
+   return 1;
+}
+
+char SpecialNumber(const char *start, const char *end)
+{
+   /* Check for the other forms accepted by strtod. */
+   if(IsPrefix(start, end, "inf") || IsPrefix(start, end, "nan") ||
+      IsPrefix(start, end, "0x")) {
+      return NUMBER_SLOW;
+   }
+   return NUMBER_NONE;
+}
+
+char ScanNumber(const char *start, const char *end, double *result)
+{
+   /* Decimal numbers with at most 19 significant digits are collected
+    * into an integer.  If that fits in 53 bits and the power of ten is
+    * exact, a single multiply or divide gives the correctly rounded
+    * result (Clinger's fast path).  Anything else goes to strtod. */
+   const char *p = start;
+   uint64_t mantissa = 0;
+   int digits = 0;
+   int exponent = 0;
+   const char *digit_start;
+   char negative = 0;
+   char any = 0;
+
+   if(*p == '+' || *p == '-') {
+      negative = *p == '-';
+      p += 1;
+   }
+   digit_start = p;
+
+   while(p < end && IS_CLASS(*p, CHAR_DIGIT)) {
+      if(mantissa > 0 || *p != '0') {
+         mantissa = mantissa * 10 + (*p - '0');
+         digits += 1;
+      }
+      any = 1;
+      p += 1;
+   }
+   if(p < end && *p == '.') {
+      p += 1;
+      while(p < end && IS_CLASS(*p, CHAR_DIGIT)) {
+         if(mantissa > 0 || *p != '0') {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += 1;
+         }
+         exponent -= 1;
+         any = 1;
+         p += 1;
+      }
+   }
+   if(!any) {
+      return SpecialNumber(digit_start, end);
+   }
+   if(p < end && (*p == 'e' || *p == 'E')) {
+      int e = 0;
+      char e_negative = 0;
+      p += 1;
+      if(p < end && (*p == '+' || *p == '-')) {
+         e_negative = *p == '-';
+         p += 1;
+      }
+      if(p == end || !IS_CLASS(*p, CHAR_DIGIT)) {
+         return NUMBER_NONE;
+      }
+      while(p < end && IS_CLASS(*p, CHAR_DIGIT)) {
+         if(e < 100000) {
+            e = e * 10 + (*p - '0');
+         }
+         p += 1;
+      }
+      exponent += e_negative ? -e : e;
+   }
+   if(p != end) {
+      return SpecialNumber(digit_start, end);
+   }
+
+   if(digits > 19 || mantissa > ((uint64_t)1 << 53)) {
+      return NUMBER_SLOW;
+   }
+   if(mantissa == 0) {
+      *result = 0.0;
+   } else if(exponent >= 0 && exponent <= 22) {
+      *result = (double)mantissa * EXACT_POWERS[exponent];
+   } else if(exponent < 0 && exponent >= -22) {
+      *result = (double)mantissa / EXACT_POWERS[-exponent];
+   } else {
+      return NUMBER_SLOW;
+   }
+   if(negative) {
+      *result = -*result;
+   }
+   return NUMBER_EXACT;
+}
+
+char SlowNumber(JLContext *context, const char *start, const char *end,
+                double *result)
+{
+   /* strtod requires a terminator. */
+   const size_t len = end - start;
+   char *temp = AllocString(context, len + 1);
+   char *stop;
+   if(temp == NULL) {
+      return 0;
+   }
+   memcpy(temp, start, len);
+   temp[len] = 0;
+   *result = strtod(temp, &stop);
+   FreeString(context, temp);
+   return stop == temp + len;
+}
+
+JLValue *ParseLiteral(JLContext *context, const char **line)
+{
+
+   /* If a token starts with '"', we treat it as a string with escape
+    * characters like in C.
+    * Otherwise, if a token can be parsed as a number, we treat it as such.
+    * Everything else is a variable.
+    * Note that function lookups happen later, here we only generate
+    * strings, numbers, and variables.
+    */
+
+   const char *end = context->parse_end;
+   const char *start = *line;
+   const char *p = start;
+   JLValue *result;
+   char kind = NUMBER_NONE;
+   double number = 0.0;
+
+   if(*start == '\"') {
+      return ParseString(context, line);
+   }
+
+   /* Determine how long this token is. */
+   while(p != end && !IS_CLASS(*p, CHAR_DELIM)) {
+      p += 1;
+   }
+   *line = p;
+
+   /* Only tokens that start like a number are parsed as one. */
+   if(IS_CLASS(*start, CHAR_NUMBER)) {
+      kind = ScanNumber(start, p, &number);
+      if(kind == NUMBER_SLOW && !SlowNumber(context, start, p, &number)) {
+         kind = NUMBER_NONE;
+      }
+   }
+
+   if(kind == NUMBER_NONE) {
+      const size_t len = p - start;
+      char *str = AllocString(context, len + 1);
+      result = str ? CreateValue(context, NULL, JLVALUE_VARIABLE) : NULL;
+      if(result == NULL) {
+         FreeString(context, str);
+         return NULL;
+      }
+      memcpy(str, start, len);
+      str[len] = 0;
+      result->value.str = str;
+   } else {
+      result = CreateValue(context, NULL, JLVALUE_NUMBER);
+      if(result) {
+         result->value.number = number;
+      }
+   }
+   return result;
+
+}
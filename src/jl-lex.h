@@ -0,0 +1,19 @@
+/**
+ * @file jl-lex.h
+ * @author Joe Wingbermuehle
+ *
+ * Scanning of tokens for the parser.
+ *
+ */
+
+#ifndef JL_LEX_H
+#define JL_LEX_H
+
+struct JLContext;
+struct JLValue;
+
+const char *SkipSpace(struct JLContext *context, const char *line);
+
+struct JLValue *ParseLiteral(struct JLContext *context, const char **line);
+
+#endif /* JL_LEX_H */
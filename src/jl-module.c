@@ -0,0 +1,206 @@
+/**
+ * @file jl-module.c
+ * @author Joe Wingbermuehle
+ *
+ * include evaluates a file in the current scope each time it is called.
+ * require evaluates a file once in the outermost scope and returns the
+ * same value on later calls unless the file has changed.  Both keep the
+ * parsed file for the life of the context.  Relative paths are resolved
+ * from the directory of the file being loaded.
+ *
+ */
+
+#include "jl-module.h"
+#include "jl-context.h"
+#include "jl-value.h"
+#include "jl-scope.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static ModuleNode *GetModule(JLContext *context, const char *name);
+static JLValue *EvaluateModule(JLContext *context, ModuleNode *module);
+
+char *GetModulePath(JLContext *context, const char *name)
+{
+   /* Returns the full path of a file or NULL if it does not exist or
+    * there is no memory for the path. */
+   char *path = NULL;
+   char *full;
+   char *result;
+
+#ifdef _WIN32
+   const char relative = !(name[0] == '/' || name[0] == '\\' ||
+                           (name[0] && name[1] == ':'));
+#else
+   const char relative = name[0] != '/';
+#endif
+   if(relative && context->module) {
+      const char *dir = context->module->path;
+      const char *slash = strrchr(dir, '/');
+#ifdef _WIN32
+      const char *bslash = strrchr(dir, '\\');
+      if(bslash > slash) {
+         slash = bslash;
+      }
+#endif
+      if(slash) {
+         const size_t dir_len = (size_t)(slash - dir) + 1;
+         const size_t name_len = strlen(name);
+         path = AllocString(context, dir_len + name_len + 1);
+         if(path == NULL) {
+            return NULL;
+         }
+         memcpy(path, dir, dir_len);
+         memcpy(&path[dir_len], name, name_len + 1);
+      }
+   }
+
+#ifdef _WIN32
+   full = _fullpath(NULL, path ? path : name, 0);
+#else
+   full = realpath(path ? path : name, NULL);
+#endif
+   if(path) {
+      FreeString(context, path);
+   }
+   if(full == NULL) {
+      return NULL;
+   }
+   result = CopyString(context, full);
+   free(full);
+   return result;
+}
+
+ModuleNode *GetModule(JLContext *context, const char *name)
+{
+   /* Find the named module, parsing it if it has not been seen or has
+    * changed. */
+   ModuleNode *module;
+   struct stat st;
+   char *path;
+
+   path = GetModulePath(context, name);
+   if(path == NULL || stat(path, &st) != 0) {
+      Error(context, "could not open %s", name);
+      if(path) {
+         FreeString(context, path);
+      }
+      return NULL;
+   }
+
+   for(module = context->modules; module; module = module->next) {
+      if(!strcmp(module->path, path)) {
+         break;
+      }
+   }
+   if(module) {
+      FreeString(context, path);
+      if(module->loading || (module->mtime == (long long)st.st_mtime &&
+                             module->size == (long long)st.st_size)) {
+         return module;
+      }
+      JLRelease(context, module->code);
+      JLRelease(context, module->result);
+      module->code = NULL;
+      module->result = NULL;
+      module->required = 0;
+   } else {
+      module = (ModuleNode*)AllocMemory(context, sizeof(ModuleNode));
+      if(module == NULL) {
+         FreeString(context, path);
+         return NULL;
+      }
+      module->path = path;
+      module->code = NULL;
+      module->result = NULL;
+      module->required = 0;
+      module->loading = 0;
+      module->next = context->modules;
+      context->modules = module;
+   }
+
+   /* Parsing changes the line used for errors. */
+   {
+      const unsigned int line = context->line;
+      module->code = JLParseFile(context, module->path);
+      context->line = line;
+   }
+   module->mtime = (long long)st.st_mtime;
+   module->size = (long long)st.st_size;
+   return module;
+}
+
+JLValue *EvaluateModule(JLContext *context, ModuleNode *module)
+{
+   ModuleNode *outer = context->module;
+   const unsigned int line = context->line;
+   JLValue *result = NULL;
+   JLValue *value;
+
+   context->module = module;
+   module->loading = 1;
+   for(value = module->code ? module->code->value.lst : NULL;
+       value && !context->error; value = value->next) {
+      JLRelease(context, result);
+      result = JLEvaluate(context, value);
+   }
+   module->loading = 0;
+   context->module = outer;
+   context->line = line;
+   return result;
+}
+
+void ReleaseModules(JLContext *context)
+{
+   while(context->modules) {
+      ModuleNode *module = context->modules;
+      context->modules = module->next;
+      JLRelease(context, module->code);
+      JLRelease(context, module->result);
+      FreeString(context, module->path);
+      FreeMemory(context, module, sizeof(ModuleNode));
+   }
+}
+
+JLValue *IncludeFunc(JLContext *context, size_t argc, JLValue **argv,
+                     void *extra)
+{
+   ModuleNode *module = GetModule(context, argv[0]->value.str);
+   if(module == NULL || context->error) {
+      return NULL;
+   }
+   return EvaluateModule(context, module);
+}
+
+JLValue *RequireFunc(JLContext *context, size_t argc, JLValue **argv,
+                     void *extra)
+{
+   ModuleNode *module = GetModule(context, argv[0]->value.str);
+   ScopeNode *scope;
+   ScopeNode *root;
+
+   if(module == NULL || context->error) {
+      return NULL;
+   }
+   if(module->loading) {
+      Error(context, "circular require: %s", module->path);
+      return NULL;
+   }
+   if(!module->required) {
+      /* Definitions go in the outermost scope so that they are visible
+       * everywhere and survive JLRollback. */
+      scope = context->scope;
+      root = scope;
+      while(root->next) {
+         root = root->next;
+      }
+      context->scope = root;
+      module->result = EvaluateModule(context, module);
+      context->scope = scope;
+      module->required = !context->error;
+   }
+   JLRetain(context, module->result);
+   return module->result;
+}
@@ -0,0 +1,46 @@
+/**
+ * @file jl-module.h
+ * @author Joe Wingbermuehle
+ *
+ * Loading files from scripts.
+ *
+ */
+
+#ifndef JL_MODULE_H
+#define JL_MODULE_H
+
+#include <stddef.h>
+
+struct JLContext;
+struct JLValue;
+
+/** A file loaded by include or require.
+ * The parsed file is kept so that it is only parsed again if the file
+ * changes.
+ */
+typedef struct ModuleNode {
+   struct ModuleNode *next;
+   char *path;             /**< Full path of the file. */
+   struct JLValue *code;   /**< List of expressions in the file. */
+   struct JLValue *result; /**< Value from require. */
+   long long mtime;        /**< Modification time when parsed. */
+   long long size;         /**< Size when parsed. */
+   char required;          /**< Set once evaluated by require. */
+   char loading;           /**< Set while being evaluated. */
+} ModuleNode;
+
+char *GetModulePath(struct JLContext *context, const char *name);
+
+void ReleaseModules(struct JLContext *context);
+
+struct JLValue *IncludeFunc(struct JLContext *context,
+                            size_t argc,
+                            struct JLValue **argv,
+                            void *extra);
+
+struct JLValue *RequireFunc(struct JLContext *context,
+                            size_t argc,
+                            struct JLValue **argv,
+                            void *extra);
+
+#endif /* JL_MODULE_H */
@@ -0,0 +1,218 @@
+/**
+ * @file jl-parser.c
+ * @author Joe Wingbermuehle
+ *
+ * Push parser for input that arrives in pieces.
+ * Input is buffered until a complete top-level expression is available,
+ * which is then parsed with JLParseN.  The scanner that finds the end of
+ * each expression is shared with input ports.
+ *
+ */
+
+#include "jl.h"
+#include "jl-parser.h"
+#include "jl-context.h"
+#include "jl-value.h"
+
+#include <string.h>
+
+typedef struct JLParser {
+   JLContext *context;
+   char *buffer;
+   size_t len;             /**< Bytes in the buffer. */
+   size_t max_len;         /**< Size of the buffer. */
+   ScanState scan;
+   char eof;
+} JLParser;
+
+static JLValue *ParseRange(JLParser *parser, size_t end);
+static void BeginExpression(ScanState *scan);
+
+void InitScan(ScanState *scan, size_t pos, unsigned int line)
+{
+   scan->start = pos;
+   scan->pos = pos;
+   scan->depth = 0;
+   scan->line = line;
+   scan->start_line = line;
+   scan->state = SCAN_SPACE;
+}
+
+JLParser *JLCreateParser(JLContext *context)
+{
+   JLParser *parser = (JLParser*)AllocMemory(context, sizeof(JLParser));
+   if(parser == NULL) {
+      return NULL;
+   }
+   parser->context = context;
+   parser->buffer = NULL;
+   parser->len = 0;
+   parser->max_len = 0;
+   InitScan(&parser->scan, 0, 1);
+   parser->eof = 0;
+   return parser;
+}
+
+void JLDestroyParser(JLParser *parser)
+{
+   JLContext *context = parser->context;
+   FreeMemory(context, parser->buffer, parser->max_len);
+   FreeMemory(context, parser, sizeof(JLParser));
+}
+
+char JLParserFeed(JLParser *parser, const char *data, size_t len)
+{
+   ScanState *scan = &parser->scan;
+   if(len == 0) {
+      parser->eof = 1;
+      return 1;
+   }
+
+   /* Drop input that has already been parsed. */
+   if(scan->state == SCAN_SPACE && scan->depth == 0) {
+      scan->start = scan->pos;
+   }
+   if(scan->start > 0) {
+      memmove(parser->buffer, &parser->buffer[scan->start],
+              parser->len - scan->start);
+      parser->len -= scan->start;
+      scan->pos -= scan->start;
+      scan->start = 0;
+   }
+
+   if(parser->len + len > parser->max_len) {
+      size_t new_len = parser->max_len ? parser->max_len : 256;
+      char *buffer;
+      while(new_len < parser->len + len) {
+         new_len *= 2;
+      }
+      buffer = (char*)ReallocMemory(parser->context, parser->buffer,
+                                    parser->max_len, new_len);
+      if(buffer == NULL) {
+         return 0;
+      }
+      parser->buffer = buffer;
+      parser->max_len = new_len;
+   }
+   memcpy(&parser->buffer[parser->len], data, len);
+   parser->len += len;
+   return 1;
+}
+
+JLValue *ParseRange(JLParser *parser, size_t end)
+{
+   JLContext *context = parser->context;
+   const char *line = &parser->buffer[parser->scan.start];
+   JLValue *result;
+   context->line = parser->scan.start_line;
+   result = JLParseN(context, &line, end - parser->scan.start);
+   parser->scan.start = end;
+   return result;
+}
+
+void BeginExpression(ScanState *scan)
+{
+   if(scan->depth == 0) {
+      scan->start = scan->pos;
+      scan->start_line = scan->line;
+   }
+}
+
+char ScanInput(ScanState *scan, const char *data, size_t len)
+{
+   while(scan->pos < len) {
+      const char ch = data[scan->pos];
+      char done = 0;
+      switch(scan->state) {
+      case SCAN_COMMENT:
+         if(ch == '\n') {
+            scan->state = SCAN_SPACE;
+            scan->line += 1;
+         }
+         scan->pos += 1;
+         break;
+      case SCAN_ESCAPE:
+         scan->state = SCAN_STRING;
+         scan->line += ch == '\n';
+         scan->pos += 1;
+         break;
+      case SCAN_STRING:
+         if(ch == '\\') {
+            scan->state = SCAN_ESCAPE;
+         } else if(ch == '\"') {
+            scan->state = SCAN_SPACE;
+            done = scan->depth == 0;
+         }
+         scan->line += ch == '\n';
+         scan->pos += 1;
+         break;
+      case SCAN_TOKEN:
+         if(ch == '(' || ch == ')' || ch == ';' || ch == ' ' ||
+            ch == '\t' || ch == '\r' || ch == '\n') {
+            /* Rescan the separator between tokens. */
+            scan->state = SCAN_SPACE;
+            done = scan->depth == 0;
+         } else {
+            scan->pos += 1;
+         }
+         break;
+      default:
+         switch(ch) {
+         case '\n':
+            scan->line += 1;
+            break;
+         case ' ':
+         case '\t':
+         case '\r':
+            break;
+         case ';':
+            scan->state = SCAN_COMMENT;
+            break;
+         case '(':
+            BeginExpression(scan);
+            scan->depth += 1;
+            break;
+         case ')':
+            /* An unmatched ')' is passed on to be reported. */
+            BeginExpression(scan);
+            scan->depth -= scan->depth > 0;
+            done = scan->depth == 0;
+            break;
+         case '\"':
+            BeginExpression(scan);
+            scan->state = SCAN_STRING;
+            break;
+         default:
+            BeginExpression(scan);
+            scan->state = SCAN_TOKEN;
+            break;
+         }
+         scan->pos += 1;
+         break;
+      }
+      if(done) {
+         return 1;
+      }
+   }
+   return 0;
+}
+
+JLValue *JLParserNext(JLParser *parser)
+{
+   ScanState *scan = &parser->scan;
+   while(ScanInput(scan, parser->buffer, parser->len)) {
+      JLValue *result = ParseRange(parser, scan->pos);
+      if(result) {
+         return result;
+      }
+   }
+
+   /* At the end of the input, parse whatever is left so that incomplete
+    * expressions are reported. */
+   if(parser->eof && (scan->state != SCAN_SPACE || scan->depth > 0)) {
+      scan->state = SCAN_SPACE;
+      scan->depth = 0;
+      return ParseRange(parser, parser->len);
+   }
+   return NULL;
+}
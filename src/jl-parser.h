@@ -0,0 +1,39 @@
+/**
+ * @file jl-parser.h
+ * @author Joe Wingbermuehle
+ *
+ * Finding the end of each expression in input that arrives in pieces.
+ *
+ */
+
+#ifndef JL_PARSER_H
+#define JL_PARSER_H
+
+#include <stddef.h>
+
+/** Scanner states. */
+#define SCAN_SPACE      0     /**< Between tokens. */
+#define SCAN_TOKEN      1     /**< In a number or symbol. */
+#define SCAN_STRING     2     /**< In a string. */
+#define SCAN_ESCAPE     3     /**< After '\' in a string. */
+#define SCAN_COMMENT    4     /**< In a comment. */
+
+/** Position of the scanner within buffered input.
+ * Only enough state to find the end of an expression (nesting depth and
+ * whether the input is in a string, escape sequence, comment, or token)
+ * is kept, so scanning can resume when more input arrives.
+ */
+typedef struct ScanState {
+   size_t start;           /**< Start of the current expression. */
+   size_t pos;             /**< Next byte to scan. */
+   unsigned int depth;     /**< Open lists in the current expression. */
+   unsigned int line;      /**< Line of the next byte to scan. */
+   unsigned int start_line;
+   char state;
+} ScanState;
+
+void InitScan(ScanState *scan, size_t pos, unsigned int line);
+
+char ScanInput(ScanState *scan, const char *data, size_t len);
+
+#endif /* JL_PARSER_H */
@@ -0,0 +1,356 @@
+/**
+ * @file jl-port.c
+ * @author Joe Wingbermuehle
+ *
+ * Ports are user data wrapping an open file.  Input is read in large
+ * pieces into a buffer that only grows to hold the longest line, chunk,
+ * or expression read, so files of any size can be processed in constant
+ * memory.
+ *
+ */
+
+#include "jl-port.h"
+#include "jl-parser.h"
+#include "jl-context.h"
+#include "jl-value.h"
+#include "jl-func.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/** Amount to read from a file at a time. */
+#define PORT_BUFFER_SIZE   65536
+
+/** An open file. */
+typedef struct Port {
+   JLContext *context;
+   FILE *fd;               /**< The file or NULL if closed. */
+   char *buffer;
+   size_t start;           /**< Next unread byte in the buffer. */
+   size_t len;             /**< Bytes in the buffer. */
+   size_t max_len;         /**< Size of the buffer. */
+   unsigned int line;      /**< Line of the next unread byte. */
+   char output;
+   char eof;
+} Port;
+
+static void FinalizePort(JLContext *context, void *data);
+static void ClosePort(Port *port);
+static JLValue *OpenPort(JLContext *context, const char *name, char output);
+static Port *GetPort(JLContext *context, JLValue *value, char output);
+static char FillPort(Port *port);
+static JLValue *TakeString(Port *port, size_t len, size_t skip);
+static JLValue *ReadLine(Port *port);
+
+static const struct JLUserType PORT_TYPE = { "port", FinalizePort };
+
+void FinalizePort(JLContext *context, void *data)
+{
+   Port *port = (Port*)data;
+   ClosePort(port);
+   FreeMemory(context, port->buffer, port->max_len);
+   FreeMemory(context, port, sizeof(Port));
+}
+
+void ClosePort(Port *port)
+{
+   if(port->fd) {
+      fclose(port->fd);
+      port->fd = NULL;
+   }
+   port->start = port->len;
+   port->eof = 1;
+}
+
+JLValue *OpenPort(JLContext *context, const char *name, char output)
+{
+   Port *port;
+   FILE *fd = fopen(name, output ? "wb" : "rb");
+   if(fd == NULL) {
+      Error(context, "could not open %s", name);
+      return NULL;
+   }
+
+   port = (Port*)AllocMemory(context, sizeof(Port));
+   if(port == NULL) {
+      fclose(fd);
+      return NULL;
+   }
+   port->context = context;
+   port->fd = fd;
+   port->buffer = NULL;
+   port->start = 0;
+   port->len = 0;
+   port->max_len = 0;
+   if(!output) {
+      port->max_len = PORT_BUFFER_SIZE;
+      port->buffer = (char*)AllocMemory(context, port->max_len);
+      if(port->buffer == NULL) {
+         fclose(fd);
+         FreeMemory(context, port, sizeof(Port));
+         return NULL;
+      }
+   }
+   port->line = 1;
+   port->output = output;
+   port->eof = 0;
+   return JLDefineUserData(context, NULL, &PORT_TYPE, port);
+}
+
+Port *GetPort(JLContext *context, JLValue *value, char output)
+{
+   /* Get the port for an argument (NULL if not a usable port). */
+   Port *port;
+   if(value == NULL || value->tag != JLVALUE_USERDATA ||
+      value->value.user->type != &PORT_TYPE) {
+      NativeArgumentError(context);
+      return NULL;
+   }
+   port = (Port*)value->value.user->data;
+   if(port->output != output) {
+      NativeArgumentError(context);
+      return NULL;
+   }
+   if(output && port->fd == NULL) {
+      Error(context, "port is closed");
+      return NULL;
+   }
+   return port;
+}
+
+char FillPort(Port *port)
+{
+   /* Read more input, moving unread input to the start of the buffer.
+    * Returns 0 at the end of the file or if out of memory. */
+   JLContext *context = port->context;
+   size_t count;
+
+   if(port->eof) {
+      return 0;
+   }
+   if(port->start > 0) {
+      memmove(port->buffer, &port->buffer[port->start],
+              port->len - port->start);
+      port->len -= port->start;
+      port->start = 0;
+   }
+   if(port->max_len - port->len < PORT_BUFFER_SIZE / 2) {
+      const size_t old_len = port->max_len;
+      const size_t new_len = old_len ? old_len * 2 : PORT_BUFFER_SIZE;
+      char *buffer = (char*)ReallocMemory(context, port->buffer,
+                                          old_len, new_len);
+      if(buffer == NULL) {
+         return 0;
+      }
+      port->buffer = buffer;
+      port->max_len = new_len;
+   }
+   count = fread(&port->buffer[port->len], 1,
+                 port->max_len - port->len, port->fd);
+   port->len += count;
+   if(count == 0) {
+      port->eof = 1;
+      return 0;
+   }
+   return 1;
+}
+
+JLValue *TakeString(Port *port, size_t len, size_t skip)
+{
+   /* Make a string of the next len bytes and consume len + skip. */
+   JLValue *result;
+   char *str = AllocString(port->context, len + 1);
+   if(str == NULL) {
+      return NULL;
+   }
+   result = CreateValue(port->context, NULL, JLVALUE_STRING);
+   if(result == NULL) {
+      FreeString(port->context, str);
+      return NULL;
+   }
+   memcpy(str, &port->buffer[port->start], len);
+   str[len] = 0;
+   result->value.str = str;
+   port->start += len + skip;
+   return result;
+}
+
+JLValue *ReadLine(Port *port)
+{
+   /* Returns the next line without its line ending or NULL at the end
+    * of the file. */
+   size_t searched = 0;
+   for(;;) {
+      const size_t available = port->len - port->start;
+      const char *start = &port->buffer[port->start];
+      const char *end = (const char*)memchr(start + searched, '\n',
+                                            available - searched);
+      if(end) {
+         size_t len = (size_t)(end - start);
+         port->line += 1;
+         if(len > 0 && start[len - 1] == '\r') {
+            return TakeString(port, len - 1, 2);
+         }
+         return TakeString(port, len, 1);
+      }
+      searched = available;
+      if(!FillPort(port)) {
+         return available > 0 ? TakeString(port, available, 0) : NULL;
+      }
+   }
+}
+
+JLValue *OpenInputFileFunc(JLContext *context, size_t argc, JLValue **argv,
+                           void *extra)
+{
+   return OpenPort(context, argv[0]->value.str, 0);
+}
+
+JLValue *OpenOutputFileFunc(JLContext *context, size_t argc, JLValue **argv,
+                            void *extra)
+{
+   return OpenPort(context, argv[0]->value.str, 1);
+}
+
+JLValue *ClosePortFunc(JLContext *context, size_t argc, JLValue **argv,
+                       void *extra)
+{
+   if(argv[0]->value.user->type != &PORT_TYPE) {
+      NativeArgumentError(context);
+   } else {
+      ClosePort((Port*)argv[0]->value.user->data);
+   }
+   return NULL;
+}
+
+JLValue *ReadLineFunc(JLContext *context, size_t argc, JLValue **argv,
+                      void *extra)
+{
+   Port *port = GetPort(context, argv[0], 0);
+   return port ? ReadLine(port) : NULL;
+}
+
+JLValue *ReadChunkFunc(JLContext *context, size_t argc, JLValue **argv,
+                       void *extra)
+{
+   Port *port = GetPort(context, argv[0], 0);
+   JLValue *size = argv[1];
+   size_t len;
+
+   if(port == NULL) {
+      return NULL;
+   }
+   if(size == NULL || size->tag != JLVALUE_NUMBER ||
+      size->value.number < 1.0) {
+      NativeArgumentError(context);
+      return NULL;
+   }
+   len = (size_t)size->value.number;
+   while(port->len - port->start < len) {
+      if(!FillPort(port)) {
+         break;
+      }
+   }
+   if(port->len - port->start < len) {
+      len = port->len - port->start;
+   }
+   return len > 0 ? TakeString(port, len, 0) : NULL;
+}
+
+JLValue *ReadDatumFunc(JLContext *context, size_t argc, JLValue **argv,
+                       void *extra)
+{
+   /* Scan for the end of the next expression, reading more input as
+    * needed, and parse it.  Offsets are relative to the unread input
+    * so that they stay valid when the buffer is refilled. */
+   JLValue *result = NULL;
+   ScanState scan;
+   Port *port = GetPort(context, argv[0], 0);
+
+   if(port == NULL) {
+      return NULL;
+   }
+
+   InitScan(&scan, 0, port->line);
+   for(;;) {
+      const char *data = &port->buffer[port->start];
+      const size_t available = port->len - port->start;
+      char done = ScanInput(&scan, data, available);
+      if(!done && !FillPort(port)) {
+         /* Parse whatever is left so that incomplete expressions are
+          * reported. */
+         if(scan.state == SCAN_SPACE && scan.depth == 0) {
+            port->line = scan.line;
+            port->start = port->len;
+            break;
+         }
+         scan.pos = available;
+         done = 1;
+      }
+      if(done) {
+         const char *line = &port->buffer[port->start + scan.start];
+         context->line = scan.start_line;
+         result = JLParseN(context, &line, scan.pos - scan.start);
+         port->start += scan.pos;
+         port->line = scan.line;
+         if(result || context->error) {
+            break;
+         }
+         InitScan(&scan, 0, port->line);
+      }
+   }
+   return result;
+}
+
+JLValue *WriteStringFunc(JLContext *context, size_t argc, JLValue **argv,
+                         void *extra)
+{
+   Port *port = GetPort(context, argv[0], 1);
+   size_t i;
+   for(i = 1; port && i < argc; i++) {
+      if(argv[i]->tag != JLVALUE_STRING) {
+         NativeArgumentError(context);
+         break;
+      }
+      fputs(argv[i]->value.str, port->fd);
+   }
+   return NULL;
+}
+
+JLValue *WriteDatumFunc(JLContext *context, size_t argc, JLValue **argv,
+                        void *extra)
+{
+   Port *port = GetPort(context, argv[0], 1);
+   size_t i;
+   for(i = 1; port && i < argc; i++) {
+      JLPrintToFile(context, argv[i], port->fd);
+   }
+   return NULL;
+}
+
+JLValue *FileLinesFunc(JLContext *context, size_t argc, JLValue **argv,
+                       void *extra)
+{
+   /* Call a function with each line of a file.  Only one line is held
+    * at a time. */
+   JLValue *port_value;
+   JLValue *line;
+   Port *port;
+
+   if(argv[0]->tag != JLVALUE_STRING || argv[1]->tag != JLVALUE_LAMBDA) {
+      NativeArgumentError(context);
+      return NULL;
+   }
+   port_value = OpenPort(context, argv[0]->value.str, 0);
+   if(port_value == NULL) {
+      return NULL;
+   }
+   port = (Port*)port_value->value.user->data;
+
+   while(!context->error && (line = ReadLine(port)) != NULL) {
+      JLRelease(context, JLCall(context, argv[1], 1, &line));
+      JLRelease(context, line);
+   }
+   JLRelease(context, port_value);
+   return NULL;
+}
@@ -0,0 +1,62 @@
+/**
+ * @file jl-port.h
+ * @author Joe Wingbermuehle
+ *
+ * Built-in functions for reading and writing files.
+ *
+ */
+
+#ifndef JL_PORT_H
+#define JL_PORT_H
+
+#include <stddef.h>
+
+struct JLContext;
+struct JLValue;
+
+struct JLValue *OpenInputFileFunc(struct JLContext *context,
+                                  size_t argc,
+                                  struct JLValue **argv,
+                                  void *extra);
+
+struct JLValue *OpenOutputFileFunc(struct JLContext *context,
+                                   size_t argc,
+                                   struct JLValue **argv,
+                                   void *extra);
+
+struct JLValue *ClosePortFunc(struct JLContext *context,
+                              size_t argc,
+                              struct JLValue **argv,
+                              void *extra);
+
+struct JLValue *ReadLineFunc(struct JLContext *context,
+                             size_t argc,
+                             struct JLValue **argv,
+                             void *extra);
+
+struct JLValue *ReadChunkFunc(struct JLContext *context,
+                              size_t argc,
+                              struct JLValue **argv,
+                              void *extra);
+
+struct JLValue *ReadDatumFunc(struct JLContext *context,
+                              size_t argc,
+                              struct JLValue **argv,
+                              void *extra);
+
+struct JLValue *WriteStringFunc(struct JLContext *context,
+                                size_t argc,
+                                struct JLValue **argv,
+                                void *extra);
+
+struct JLValue *WriteDatumFunc(struct JLContext *context,
+                               size_t argc,
+                               struct JLValue **argv,
+                               void *extra);
+
+struct JLValue *FileLinesFunc(struct JLContext *context,
+                              size_t argc,
+                              struct JLValue **argv,
+                              void *extra);
+
+#endif /* JL_PORT_H */
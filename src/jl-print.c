@@ -0,0 +1,303 @@
+/**
+ * @file jl-print.c
+ * @author Joe Wingbermuehle
+ *
+ * Displaying values.  Output is either appended to a buffer returned to
+ * the caller or collected in a fixed chunk and written to a file in large
+ * pieces.
+ *
+ */
+
+#include "jl.h"
+#include "jl-context.h"
+#include "jl-value.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/** Amount of output to collect before writing to a file. */
+#define PRINT_CHUNK     4096
+
+/** Depth of nested lists printed before the stack is allocated. */
+#define PRINT_DEPTH     32
+
+/** Largest integer that can be printed without formatting. */
+#define MAX_EXACT       9007199254740992.0
+
+/** State for printing a value. */
+typedef struct Printer {
+   const JLContext *context;
+   JLContext *owner;          /**< Context of the buffer (NULL for files). */
+   struct JLBuffer *buffer;   /**< Buffer to fill or NULL. */
+   FILE *fd;                  /**< File to write or NULL. */
+   char *chunk;               /**< Output waiting to be written to fd. */
+   size_t chunk_len;
+   char failed;               /**< Set if out of memory. */
+} Printer;
+
+static char Reserve(Printer *printer, size_t len);
+static void Flush(Printer *printer);
+static const JLValue **GrowStack(const JLContext *context,
+                                 const JLValue **stack,
+                                 const JLValue **local,
+                                 size_t depth);
+static void PutString(Printer *printer, const char *str, size_t len);
+static size_t FormatNumber(double value, char *str);
+static void PrintAtom(Printer *printer, const JLValue *value);
+static void PrintValue(Printer *printer, const JLValue *value);
+
+char Reserve(Printer *printer, size_t len)
+{
+   /* Leave room for the terminator.  Returns 0 if out of memory. */
+   struct JLBuffer *buffer = printer->buffer;
+   if(buffer->length + len + 1 > buffer->capacity) {
+      size_t capacity = buffer->capacity ? buffer->capacity : 256;
+      char *data;
+      while(buffer->length + len + 1 > capacity) {
+         capacity *= 2;
+      }
+      data = (char*)ReallocMemory(printer->owner, buffer->data,
+                                  buffer->capacity, capacity);
+      if(data == NULL) {
+         printer->failed = 1;
+         return 0;
+      }
+      buffer->data = data;
+      buffer->capacity = capacity;
+   }
+   return 1;
+}
+
+void Flush(Printer *printer)
+{
+   if(printer->chunk_len > 0) {
+      fwrite(printer->chunk, 1, printer->chunk_len, printer->fd);
+      printer->chunk_len = 0;
+   }
+}
+
+const JLValue **GrowStack(const JLContext *context, const JLValue **stack,
+                          const JLValue **local, size_t depth)
+{
+   /* The stack only lives while printing, so it is taken directly from
+    * the allocator and not counted against the memory limit.  Returns
+    * NULL if out of memory. */
+   const JLValue **result = (const JLValue**)(context->alloc_func)(
+      context->alloc_arg, 2 * depth * sizeof(JLValue*));
+   if(result) {
+      memcpy(result, stack, depth * sizeof(JLValue*));
+   }
+   if(stack != local) {
+      (context->free_func)(context->alloc_arg, stack,
+                           depth * sizeof(JLValue*));
+   }
+   return result;
+}
+
+void PutString(Printer *printer, const char *str, size_t len)
+{
+   if(printer->failed) {
+      return;
+   }
+   if(printer->fd) {
+      if(printer->chunk_len + len > PRINT_CHUNK) {
+         Flush(printer);
+         if(len > PRINT_CHUNK) {
+            fwrite(str, 1, len, printer->fd);
+            return;
+         }
+      }
+      memcpy(&printer->chunk[printer->chunk_len], str, len);
+      printer->chunk_len += len;
+   } else if(Reserve(printer, len)) {
+      memcpy(&printer->buffer->data[printer->buffer->length], str, len);
+      printer->buffer->length += len;
+   }
+}
+
+size_t FormatNumber(double value, char *str)
+{
+   /* Integers are formatted directly.  Anything else uses the fewest
+    * digits that read back as the same value. */
+   int precision;
+   if(value > -MAX_EXACT && value < MAX_EXACT &&
+      value == (double)(long long)value &&
+      !(value == 0.0 && signbit(value))) {
+      char digits[24];
+      long long n = (long long)value;
+      unsigned long long u = n < 0 ? -(unsigned long long)n : n;
+      size_t len = 0;
+      size_t i = 0;
+      do {
+         digits[len++] = (char)('0' + u % 10);
+         u /= 10;
+      } while(u);
+      if(n < 0) {
+         str[i++] = '-';
+      }
+      while(len > 0) {
+         str[i++] = digits[--len];
+      }
+      str[i] = 0;
+      return i;
+   }
+   if(isnan(value) || isinf(value)) {
+      return (size_t)sprintf(str, "%g", value);
+   }
+   for(precision = 15; precision < 17; precision++) {
+      sprintf(str, "%.*g", precision, value);
+      if(strtod(str, NULL) == value) {
+         return strlen(str);
+      }
+   }
+   return (size_t)sprintf(str, "%.17g", value);
+}
+
+void PrintAtom(Printer *printer, const JLValue *value)
+{
+   char temp[64];
+   size_t len;
+   if(value == NULL || value->tag == JLVALUE_NIL) {
+      PutString(printer, "nil", 3);
+      return;
+   }
+   switch(value->tag) {
+   case JLVALUE_NUMBER:
+      len = FormatNumber(value->value.number, temp);
+      PutString(printer, temp, len);
+      break;
+   case JLVALUE_STRING:
+      PutString(printer, "\"", 1);
+      PutString(printer, value->value.str, strlen(value->value.str));
+      PutString(printer, "\"", 1);
+      break;
+   case JLVALUE_SPECIAL:
+      len = (size_t)sprintf(temp, "special@%p(%p)",
+                            value->value.special->func,
+                            value->value.special->extra);
+      PutString(printer, temp, len);
+      break;
+   case JLVALUE_NATIVE:
+      len = (size_t)sprintf(temp, "native@%p(%p)",
+                            value->value.native->func,
+                            value->value.native->extra);
+      PutString(printer, temp, len);
+      break;
+   case JLVALUE_VARIABLE:
+      PutString(printer, value->value.str, strlen(value->value.str));
+      break;
+   case JLVALUE_USERDATA:
+      PutString(printer, value->value.user->type->name,
+                strlen(value->value.user->type->name));
+      len = (size_t)sprintf(temp, "@%p", value->value.user->data);
+      PutString(printer, temp, len);
+      break;
+   default:
+      PutString(printer, "\n?\n", 3);
+      break;
+   }
+}
+
+void PrintValue(Printer *printer, const JLValue *value)
+{
+   /* Lists are printed with an explicit stack holding the item being
+    * printed in each open list. */
+   const JLValue *local[PRINT_DEPTH];
+   const JLValue **stack = local;
+   size_t depth = 0;
+   size_t max_depth = PRINT_DEPTH;
+
+   for(;;) {
+      const JLValue *item = NULL;
+      if(value && value->tag == JLVALUE_LIST) {
+         PutString(printer, "(", 1);
+         item = value->value.lst;
+      } else if(value && value->tag == JLVALUE_LAMBDA) {
+         PutString(printer, "(lambda ", 8);
+         item = value->value.lst->next;
+      } else {
+         PrintAtom(printer, value);
+      }
+
+      if(item) {
+         /* Descend into the list. */
+         if(depth == max_depth) {
+            stack = GrowStack(printer->context, stack, local, max_depth);
+            if(stack == NULL) {
+               printer->failed = 1;
+               return;
+            }
+            max_depth *= 2;
+         }
+         stack[depth++] = item;
+         value = item;
+         continue;
+      } else if(value && (value->tag == JLVALUE_LIST ||
+                          value->tag == JLVALUE_LAMBDA)) {
+         PutString(printer, ")", 1);
+      }
+
+      /* Move to the next item, closing finished lists. */
+      while(depth > 0 && stack[depth - 1]->next == NULL) {
+         PutString(printer, ")", 1);
+         depth -= 1;
+      }
+      if(depth == 0) {
+         break;
+      }
+      PutString(printer, " ", 1);
+      stack[depth - 1] = stack[depth - 1]->next;
+      value = stack[depth - 1];
+   }
+   if(stack != local) {
+      (printer->context->free_func)(printer->context->alloc_arg, stack,
+                                    max_depth * sizeof(JLValue*));
+   }
+}
+
+void JLPrint(const JLContext *context, const JLValue *value)
+{
+   JLPrintToFile(context, value, stdout);
+}
+
+void JLPrintToFile(const JLContext *context, const JLValue *value, FILE *fd)
+{
+   char chunk[PRINT_CHUNK];
+   Printer printer;
+   printer.context = context;
+   printer.owner = NULL;
+   printer.buffer = NULL;
+   printer.fd = fd;
+   printer.chunk = chunk;
+   printer.chunk_len = 0;
+   printer.failed = 0;
+   PrintValue(&printer, value);
+   Flush(&printer);
+}
+
+void JLPrintToBuffer(JLContext *context, const JLValue *value,
+                     struct JLBuffer *buffer)
+{
+   Printer printer;
+   printer.context = context;
+   printer.owner = context;
+   printer.buffer = buffer;
+   printer.fd = NULL;
+   printer.chunk = NULL;
+   printer.chunk_len = 0;
+   printer.failed = 0;
+   PrintValue(&printer, value);
+   if(buffer->data) {
+      buffer->data[buffer->length] = 0;
+   }
+}
+
+void JLFreeBuffer(JLContext *context, struct JLBuffer *buffer)
+{
+   FreeMemory(context, buffer->data, buffer->capacity);
+   buffer->data = NULL;
+   buffer->length = 0;
+   buffer->capacity = 0;
+}
@@ -0,0 +1,391 @@
+/**
+ * @file jl-schema.c
+ * @author Joe Wingbermuehle
+ *
+ * Decoding values into host structures.
+ *
+ * A record is a list of entries and an entry is a list whose head is the
+ * name of a field, followed by the value of the field.  For example:
+ *
+ *    (list (list "width" 3)
+ *          (list "tray" (list "height" 24) (list "autohide" 1)))
+ *
+ * Nested records take the rest of the entry as their entries.  Schemas
+ * keep a hash table of their field names, so each entry is matched with
+ * one hash and one string comparison.
+ *
+ */
+
+#include "jl-context.h"
+#include "jl-value.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+/** Size of the buffer for the name of a field in errors. */
+#define PATH_SIZE    256
+
+/** Index for path nodes that are not array elements. */
+#define NO_INDEX     ((size_t)-1)
+
+/** A field with its precomputed hash. */
+typedef struct SchemaField {
+   struct JLField field;
+   unsigned int hash;
+} SchemaField;
+
+/** A compiled schema.
+ * The fields and hash table follow the structure in the same block.
+ */
+struct JLSchema {
+   JLContext *context;
+   size_t size;            /**< Size of the structure. */
+   size_t count;           /**< Number of fields. */
+   size_t mask;            /**< Number of hash table slots - 1. */
+   SchemaField *fields;
+   size_t *slots;          /**< Index + 1 of the field in each slot. */
+};
+
+/** The field being decoded, used for errors. */
+typedef struct PathNode {
+   const struct PathNode *parent;
+   const char *name;
+   size_t index;           /**< Array element or NO_INDEX. */
+} PathNode;
+
+static unsigned int HashKey(const char *name);
+static size_t GetSchemaSize(size_t count, size_t slot_count);
+static const SchemaField *FindField(const struct JLSchema *schema,
+                                    const char *name);
+static size_t GetElementSize(const struct JLField *field);
+static size_t GetArrayCapacity(size_t count);
+static char *AppendElement(JLContext *context, const struct JLField *field,
+                           char *data);
+static size_t FormatPath(char *buffer, size_t size, const PathNode *node);
+static void DecodeError(JLContext *context, const PathNode *node,
+                        const char *msg);
+static char DecodeRecord(JLContext *context, const struct JLSchema *schema,
+                         JLValue *entries, char *data,
+                         const PathNode *parent);
+static char DecodeField(JLContext *context, const struct JLField *field,
+                        JLValue *args, char *dest, const PathNode *node);
+
+unsigned int HashKey(const char *name)
+{
+   /* 32-bit FNV-1a. */
+   unsigned int hash = 0x811c9dc5u;
+   while(*name) {
+      hash ^= (unsigned char)*name;
+      hash *= 16777619u;
+      name += 1;
+   }
+   return hash;
+}
+
+size_t GetSchemaSize(size_t count, size_t slot_count)
+{
+   return sizeof(struct JLSchema) + count * sizeof(SchemaField)
+        + slot_count * sizeof(size_t);
+}
+
+const SchemaField *FindField(const struct JLSchema *schema, const char *name)
+{
+   const unsigned int hash = HashKey(name);
+   size_t slot = hash & schema->mask;
+   while(schema->slots[slot]) {
+      const SchemaField *field = &schema->fields[schema->slots[slot] - 1];
+      if(field->hash == hash && !strcmp(field->field.name, name)) {
+         return field;
+      }
+      slot = (slot + 1) & schema->mask;
+   }
+   return NULL;
+}
+
+size_t GetElementSize(const struct JLField *field)
+{
+   switch(field->type & ~JLFIELD_ARRAY) {
+   case JLFIELD_NUMBER:
+      return sizeof(double);
+   case JLFIELD_INT:
+      return sizeof(int);
+   case JLFIELD_BOOL:
+      return sizeof(char);
+   case JLFIELD_STRING:
+      return sizeof(const char*);
+   default:
+      return field->schema->size;
+   }
+}
+
+size_t GetArrayCapacity(size_t count)
+{
+   /* Arrays grow by doubling, so the capacity follows from the count. */
+   size_t capacity = 4;
+   if(count == 0) {
+      return 0;
+   }
+   while(capacity < count) {
+      capacity *= 2;
+   }
+   return capacity;
+}
+
+char *AppendElement(JLContext *context, const struct JLField *field,
+                    char *data)
+{
+   /* Add a zeroed element to an array field and return it (NULL if out
+    * of memory). */
+   char **array = (char**)(data + field->offset);
+   size_t *count = (size_t*)(data + field->count_offset);
+   const size_t size = GetElementSize(field);
+   const size_t capacity = GetArrayCapacity(*count);
+   char *element;
+
+   if(*count == capacity) {
+      const size_t new_capacity = GetArrayCapacity(*count + 1);
+      char *temp;
+      if(capacity) {
+         temp = (char*)ReallocMemory(context, *array, capacity * size,
+                                     new_capacity * size);
+      } else {
+         temp = (char*)AllocMemory(context, new_capacity * size);
+      }
+      if(temp == NULL) {
+         return NULL;
+      }
+      *array = temp;
+   }
+   element = *array + *count * size;
+   memset(element, 0, size);
+   *count += 1;
+   return element;
+}
+
+size_t FormatPath(char *buffer, size_t size, const PathNode *node)
+{
+   /* Write the path to a field from the root, returning its length. */
+   size_t len = 0;
+   int written;
+   if(node->parent) {
+      len = FormatPath(buffer, size, node->parent);
+      if(len + 1 < size) {
+         buffer[len] = '.';
+         len += 1;
+      }
+   }
+   if(node->index == NO_INDEX) {
+      written = snprintf(&buffer[len], size - len, "%s", node->name);
+   } else {
+      written = snprintf(&buffer[len], size - len, "%s[%lu]", node->name,
+                         (unsigned long)node->index);
+   }
+   if(written > 0) {
+      len += (size_t)written;
+   }
+   return len < size ? len : size - 1;
+}
+
+void DecodeError(JLContext *context, const PathNode *node, const char *msg)
+{
+   if(node) {
+      char path[PATH_SIZE];
+      FormatPath(path, sizeof(path), node);
+      Error(context, "%s: %s", path, msg);
+   } else {
+      Error(context, "%s", msg);
+   }
+}
+
+char DecodeRecord(JLContext *context, const struct JLSchema *schema,
+                  JLValue *entries, char *data, const PathNode *parent)
+{
+   JLValue *entry;
+   for(entry = entries; entry; entry = entry->next) {
+      const SchemaField *field;
+      const JLValue *key;
+      PathNode node;
+      char *dest;
+
+      if(entry->tag != JLVALUE_LIST || entry->value.lst == NULL
+         || entry->value.lst->tag != JLVALUE_STRING) {
+         DecodeError(context, parent, "expected a list starting with a name");
+         return 0;
+      }
+      key = entry->value.lst;
+      field = FindField(schema, key->value.str);
+      node.parent = parent;
+      node.name = key->value.str;
+      node.index = NO_INDEX;
+      if(field == NULL) {
+         DecodeError(context, &node, "unknown field");
+         return 0;
+      }
+      if(field->field.type & JLFIELD_ARRAY) {
+         node.index = *(size_t*)(data + field->field.count_offset);
+         dest = AppendElement(context, &field->field, data);
+         if(dest == NULL) {
+            return 0;
+         }
+      } else {
+         dest = data + field->field.offset;
+      }
+      if(!DecodeField(context, &field->field, key->next, dest, &node)) {
+         return 0;
+      }
+   }
+   return 1;
+}
+
+char DecodeField(JLContext *context, const struct JLField *field,
+                 JLValue *args, char *dest, const PathNode *node)
+{
+   const unsigned int type = field->type & ~JLFIELD_ARRAY;
+   if(type == JLFIELD_RECORD) {
+      return DecodeRecord(context, field->schema, args, dest, node);
+   }
+   if(args == NULL || args->next) {
+      DecodeError(context, node, "expected one value");
+      return 0;
+   }
+   switch(type) {
+   case JLFIELD_NUMBER:
+   case JLFIELD_INT:
+      if(args->tag != JLVALUE_NUMBER) {
+         DecodeError(context, node, "expected a number");
+         return 0;
+      }
+      if(type == JLFIELD_NUMBER) {
+         *(double*)dest = args->value.number;
+         return 1;
+      }
+      /* Converting NaN or a value out of range is undefined, so only
+       * values that truncate to an int are accepted.  The comparisons
+       * are false for NaN. */
+      if(!(args->value.number > (double)INT_MIN - 1.0
+           && args->value.number < (double)INT_MAX + 1.0)) {
+         DecodeError(context, node, "expected an integer");
+         return 0;
+      }
+      *(int*)dest = (int)args->value.number;
+      return 1;
+   case JLFIELD_BOOL:
+      /* 0 and nil are false as in conditions. */
+      if(args->tag == JLVALUE_NUMBER) {
+         *dest = args->value.number != 0.0;
+      } else if(args->tag == JLVALUE_LIST) {
+         *dest = args->value.lst != NULL;
+      } else {
+         *dest = 1;
+      }
+      return 1;
+   default:
+      if(args->tag != JLVALUE_STRING) {
+         DecodeError(context, node, "expected a string");
+         return 0;
+      }
+      *(const char**)dest = args->value.str;
+      return 1;
+   }
+}
+
+struct JLSchema *JLCreateSchema(JLContext *context,
+                                size_t size,
+                                size_t count,
+                                const struct JLField *fields)
+{
+   struct JLSchema *schema;
+   size_t slot_count = 8;
+   size_t i;
+
+   for(i = 0; i < count; i++) {
+      const unsigned int type = fields[i].type & ~JLFIELD_ARRAY;
+      if(fields[i].name == NULL || type < JLFIELD_NUMBER
+         || type > JLFIELD_RECORD
+         || (type == JLFIELD_RECORD && fields[i].schema == NULL)) {
+         Error(context, "invalid schema field %lu", (unsigned long)i);
+         return NULL;
+      }
+   }
+
+   while(slot_count < count * 2) {
+      slot_count *= 2;
+   }
+   schema = (struct JLSchema*)AllocMemory(context,
+                                          GetSchemaSize(count, slot_count));
+   if(schema == NULL) {
+      return NULL;
+   }
+   schema->context = context;
+   schema->size = size;
+   schema->count = count;
+   schema->mask = slot_count - 1;
+   schema->fields = (SchemaField*)(schema + 1);
+   schema->slots = (size_t*)(schema->fields + count);
+   memset(schema->slots, 0, slot_count * sizeof(size_t));
+
+   for(i = 0; i < count; i++) {
+      SchemaField *field = &schema->fields[i];
+      size_t slot;
+      field->field = fields[i];
+      field->hash = HashKey(fields[i].name);
+      if(FindField(schema, fields[i].name)) {
+         Error(context, "duplicate schema field %s", fields[i].name);
+         JLDestroySchema(schema);
+         return NULL;
+      }
+      slot = field->hash & schema->mask;
+      while(schema->slots[slot]) {
+         slot = (slot + 1) & schema->mask;
+      }
+      schema->slots[slot] = i + 1;
+   }
+   return schema;
+}
+
+void JLDestroySchema(struct JLSchema *schema)
+{
+   FreeMemory(schema->context, schema,
+              GetSchemaSize(schema->count, schema->mask + 1));
+}
+
+char JLDecode(const struct JLSchema *schema, struct JLValue *value,
+              void *data)
+{
+   JLContext *context = schema->context;
+   if(value == NULL || (value->tag == JLVALUE_LIST && !value->value.lst)) {
+      return 1;
+   }
+   if(value->tag != JLVALUE_LIST) {
+      Error(context, "expected a list of fields");
+      return 0;
+   }
+   return DecodeRecord(context, schema, value->value.lst, (char*)data, NULL);
+}
+
+void JLFreeDecoded(const struct JLSchema *schema, void *data)
+{
+   JLContext *context = schema->context;
+   char *base = (char*)data;
+   size_t i;
+   for(i = 0; i < schema->count; i++) {
+      const struct JLField *field = &schema->fields[i].field;
+      if(field->type & JLFIELD_ARRAY) {
+         char **array = (char**)(base + field->offset);
+         size_t *count = (size_t*)(base + field->count_offset);
+         const size_t size = GetElementSize(field);
+         if(field->type == (JLFIELD_RECORD | JLFIELD_ARRAY)) {
+            size_t j;
+            for(j = 0; j < *count; j++) {
+               JLFreeDecoded(field->schema, *array + j * size);
+            }
+         }
+         FreeMemory(context, *array, GetArrayCapacity(*count) * size);
+         *array = NULL;
+         *count = 0;
+      } else if(field->type == JLFIELD_RECORD) {
+         JLFreeDecoded(field->schema, base + field->offset);
+      }
+   }
+}
@@ -6,48 +6,50 @@
 #include "jl-scope.h"
 #include "jl-context.h"
 #include "jl-value.h"
+#include "jl-gc.h"
+#include "jl-func.h"
 
 #include <stdlib.h>
 #include <string.h>
 
-static unsigned int CountScopeBindings(BindingNode *binding, ScopeNode *scope);
 static void ReleaseBindings(JLContext *context, BindingNode *binding);
+static size_t GetScopeDepth(const JLContext *context);
 
-unsigned int CountScopeBindings(BindingNode *binding, ScopeNode *scope)
+void ReleaseBindings(JLContext *context, BindingNode *binding)
 {
-   unsigned int count = 0;
-   if(binding) {
-      count += CountScopeBindings(binding->left, scope);
-      count += CountScopeBindings(binding->right, scope);
-      if(binding->value &&
-         binding->value->tag == JLVALUE_LAMBDA &&
-         binding->value->count == 1) {
-         if(binding->value->value.lst->value.scope == scope) {
-            count += 1;
-         }
+   while(binding) {
+      if(binding->left) {
+         /* Rotate right so that the tree can be freed in order without
+          * recursion. */
+         BindingNode *left = binding->left;
+         binding->left = left->right;
+         left->right = binding;
+         binding = left;
+      } else {
+         BindingNode *right = binding->right;
+         FreeString(context, binding->name);
+         JLRelease(context, binding->value);
+         PutFree(context, BLOCK_BINDING, binding);
+         binding = right;
       }
    }
-   return count;
 }
 
-void ReleaseBindings(JLContext *context, BindingNode *binding)
+char JLEnterScope(JLContext *context)
 {
-   if(binding) {
-      ReleaseBindings(context, binding->left);
-      ReleaseBindings(context, binding->right);
-      free(binding->name);
-      JLRelease(context, binding->value);
-      PutFree(context, binding);
+   ScopeNode *scope = (ScopeNode*)GetFree(context, BLOCK_SCOPE);
+   if(scope == NULL) {
+      return 0;
    }
-}
-
-void JLEnterScope(JLContext *context)
-{
-   ScopeNode *scope = (ScopeNode*)GetFree(context);
    scope->count = 1;
+   scope->color = GC_NONE;
    scope->bindings = NULL;
    scope->next = context->scope;
+   if(scope->next) {
+      scope->next->count += 1;
+   }
    context->scope = scope;
+   return 1;
 }
 
 void JLLeaveScope(JLContext *context)
@@ -57,21 +59,63 @@ void JLLeaveScope(JLContext *context)
    ReleaseScope(context, scope);
 }
 
-void ReleaseScope(JLContext *context, ScopeNode *scope)
+size_t GetScopeDepth(const JLContext *context)
+{
+   const ScopeNode *scope;
+   size_t depth = 0;
+   for(scope = context->scope; scope; scope = scope->next) {
+      depth += 1;
+   }
+   return depth;
+}
+
+size_t JLCheckpoint(JLContext *context)
 {
-   const unsigned int new_count = scope->count - 1
-                                - CountScopeBindings(scope->bindings, scope);
-   if(new_count == 0) {
+   const size_t mark = GetScopeDepth(context);
+   JLEnterScope(context);
+   return mark;
+}
+
+void JLRollback(JLContext *context, size_t mark)
+{
+   size_t depth = GetScopeDepth(context);
+   while(depth > mark) {
+      /* Drop the bindings even if lambdas still refer to the scope.
+       * This breaks the cycles formed by definitions so that the
+       * scope is freed now rather than by the cycle collector. */
+      ScopeNode *scope = context->scope;
       ReleaseBindings(context, scope->bindings);
-      PutFree(context, scope);
-   } else {
+      scope->bindings = NULL;
+      JLLeaveScope(context);
+      depth -= 1;
+   }
+   ProcessReleases(context, 0);
+   context->error = 0;
+   JLEnterScope(context);
+}
+
+void ReleaseScope(JLContext *context, ScopeNode *scope)
+{
+   /* Each scope holds a reference to its parent.
+    * Scopes that are kept alive by cycles through lambdas are
+    * reclaimed by the cycle collector. */
+   while(scope) {
+      ScopeNode *next = scope->next;
       scope->count -= 1;
+      if(scope->count > 0) {
+         break;
+      }
+      ReleaseBindings(context, scope->bindings);
+      PutFree(context, BLOCK_SCOPE, scope);
+      scope = next;
    }
 }
 
 JLValue *Lookup(JLContext *context, const char *name)
 {
+   /* Builtins are found after every scope, so they can be redefined. */
    const ScopeNode *scope = context->scope;
+   JLValue *result;
    while(scope) {
       const BindingNode *binding = scope->bindings;
       while(binding) {
@@ -86,6 +130,9 @@ JLValue *Lookup(JLContext *context, const char *name)
       }
       scope = scope->next;
    }
+   if(FindBuiltin(name, &result)) {
+      return result;
+   }
    Error(context, "symbol not found: %s", name);
    return NULL;
 }
@@ -16,10 +16,16 @@ typedef struct BindingNode {
    struct BindingNode *right;
 } BindingNode;
 
+/** A lexical scope.
+ * Scopes are reference counted.  The count includes a reference from
+ * each child scope, each lambda that captured the scope, and the
+ * context while the scope is active.
+ */
 typedef struct ScopeNode {
    BindingNode *bindings;
    struct ScopeNode *next;
    unsigned int count;
+   char color;
 } ScopeNode;
 
 void ReleaseScope(struct JLContext *context, ScopeNode *scope);
@@ -5,12 +5,19 @@
 
 #include "jl-value.h"
 #include "jl-context.h"
+#include "jl-gc.h"
 #include <string.h>
 
 JLValue *CreateValue(JLContext *context, const char *name, JLValueType tag)
 {
-   JLValue *result = (JLValue*)GetFree(context);
+   JLValue *result = (JLValue*)GetFree(context, BLOCK_VALUE);
+   if(result == NULL) {
+      return NULL;
+   }
    result->tag = tag;
+   result->flags = 0;
+   result->color = GC_NONE;
+   result->value.lst = NULL;
    result->next = NULL;
    result->count = 1;
    JLDefineValue(context, name, result);
@@ -19,26 +26,64 @@ JLValue *CreateValue(JLContext *context, const char *name, JLValueType tag)
 
 JLValue *CopyValue(JLContext *context, const JLValue *other)
 {
-   JLValue *result = NULL;
-   if(other) {
-      result = CreateValue(context, NULL, other->tag);
-      result->value = other->value;
-      switch(result->tag) {
-      case JLVALUE_LIST:
-      case JLVALUE_LAMBDA:
-      case JLVALUE_SCOPE:
-         JLRetain(context, result->value.lst);
-         break;
-      case JLVALUE_STRING:
-      case JLVALUE_VARIABLE:
-         result->value.str = strdup(result->value.str);
-         break;
-      default:
-         break;
+   /* Returns NULL if out of memory.  The copy stays nil until its
+    * payload is allocated so that it can be released on a failure. */
+   JLValue *result = CreateValue(context, NULL, JLVALUE_NIL);
+   if(result == NULL || other == NULL) {
+      return result;
+   }
+   switch(other->tag) {
+   case JLVALUE_LIST:
+   case JLVALUE_LAMBDA:
+   case JLVALUE_SCOPE:
+      JLRetain(context, other->value.lst);
+      result->value.lst = other->value.lst;
+      break;
+   case JLVALUE_STRING:
+   case JLVALUE_VARIABLE:
+      result->value.str = CopyString(context, other->value.str);
+      if(result->value.str == NULL) {
+         JLRelease(context, result);
+         return NULL;
+      }
+      break;
+   case JLVALUE_USERDATA:
+      result->value.user = other->value.user;
+      result->value.user->count += 1;
+      break;
+   case JLVALUE_SPECIAL:
+      result->value.special = (SpecialFunction*)GetFree(context,
+                                                        BLOCK_NODE);
+      if(result->value.special == NULL) {
+         JLRelease(context, result);
+         return NULL;
+      }
+      *result->value.special = *other->value.special;
+      break;
+   case JLVALUE_NATIVE:
+      result->value.native = (NativeFunction*)GetFree(context,
+                                                      BLOCK_NODE);
+      if(result->value.native == NULL) {
+         JLRelease(context, result);
+         return NULL;
       }
-   } else {
-      result = CreateValue(context, NULL, JLVALUE_NIL);
+      *result->value.native = *other->value.native;
+      break;
+   default:
+      result->value = other->value;
+      break;
    }
+   result->tag = other->tag;
    return result;
 }
 
+void ReleaseUserData(JLContext *context, UserData *user)
+{
+   user->count -= 1;
+   if(user->count == 0) {
+      if(user->type->finalize) {
+         (user->type->finalize)(context, user->data);
+      }
+      PutFree(context, BLOCK_NODE, user);
+   }
+}
@@ -18,6 +18,16 @@ typedef char JLValueType;
 #define JLVALUE_SPECIAL    5     /**< Special form. */
 #define JLVALUE_SCOPE      6     /**< A scope (internal use). */
 #define JLVALUE_VARIABLE   7     /**< A variable. */
+#define JLVALUE_USERDATA   8     /**< Host data. */
+#define JLVALUE_NATIVE     9     /**< Function with evaluated arguments. */
+
+/** Bit for a value type in a JLTYPE_* mask. */
+#define TYPE_BIT(tag)      (1u << (tag))
+
+/** Value flags. */
+#define JLFLAG_INTERNED    0x01  /**< Shared through the intern table. */
+#define JLFLAG_STATIC      0x02  /**< Builtin, not reference counted. */
+#define JLFLAG_PENDING     0x04  /**< Left for the collector to free. */
 
 /** Special function and extra parameter. */
 typedef struct SpecialFunction {
@@ -25,20 +35,44 @@ typedef struct SpecialFunction {
    void *extra;
 } SpecialFunction;
 
+/** Native function and its declaration. */
+typedef struct NativeFunction {
+   JLNativeFunction func;
+   void *extra;
+   unsigned int min_args;
+   unsigned int max_args;
+   unsigned int types;     /**< Mask of TYPE_BIT values. */
+} NativeFunction;
+
+/** Host data shared by copies of a user data value.
+ * The finalizer runs when the last copy is released.
+ */
+typedef struct UserData {
+   void *data;
+   const struct JLUserType *type;
+   unsigned int count;
+} UserData;
+
 /** Values in the JL environment.
  * Note that these are reference counted.
+ * Payloads larger than a pointer are stored out of line to keep
+ * values small.
  */
 typedef struct JLValue {
    union {
       struct JLValue *lst;
-      SpecialFunction special;
+      SpecialFunction *special;
+      NativeFunction *native;
       char *str;
       double number;
       void *scope;
+      UserData *user;
    } value;
    struct JLValue *next;
    unsigned int count;
    JLValueType tag;
+   char flags;
+   char color;
 } JLValue;
 
 JLValue *CreateValue(struct JLContext *context,
@@ -46,4 +80,6 @@ JLValue *CreateValue(struct JLContext *context,
 
 JLValue *CopyValue(struct JLContext *context, const JLValue *other);
 
+void ReleaseUserData(struct JLContext *context, UserData *user);
+
 #endif /* JL_VALUE_H */
@@ -8,80 +8,188 @@
 #include "jl-value.h"
 #include "jl-scope.h"
 #include "jl-func.h"
+#include "jl-intern.h"
+#include "jl-gc.h"
+#include "jl-lex.h"
+#include "jl-module.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
+#include <limits.h>
+
+/** Number of native function arguments held on the stack. */
+#define NATIVE_STACK_ARGS  8
 
 static JLValue *EvalLambda(JLContext *context,
                            const JLValue *lambda,
                            JLValue *args);
-static JLValue *ParseLiteral(JLContext *context, const char **line);
-static JLValue *ParseList(JLContext *context, const char **line);
+static JLValue *EvalNative(JLContext *context,
+                           const JLValue *native,
+                           JLValue *args);
+static char CheckLambda(JLContext *context, const JLValue *lambda);
+static JLValue *EvalBody(JLContext *context, JLValue *code);
+static char Peek(const JLContext *context, const char **line);
 static JLValue *ParseExpression(JLContext *context, const char **line);
+static JLValue *ParseBounded(JLContext *context, const char **line,
+                             const char *end);
 
 void JLRetain(JLContext *context, JLValue *value)
 {
-   if(value) {
+   if(value && !(value->flags & JLFLAG_STATIC)) {
       value->count += 1;
    }
 }
 
 void JLRelease(JLContext *context, JLValue *value)
 {
-   while(value) {
+   if(value && !(value->flags & JLFLAG_STATIC)) {
       value->count -= 1;
       if(value->count == 0) {
-         JLValue *next = value->next;
-         switch(value->tag) {
-         case JLVALUE_LIST:
-         case JLVALUE_LAMBDA:
-            JLRelease(context, value->value.lst);
-            break;
-         case JLVALUE_STRING:
-         case JLVALUE_VARIABLE:
-            free(value->value.str);
-            break;
-         case JLVALUE_SCOPE:
-            ReleaseScope(context, (ScopeNode*)value->value.scope);
-            break;
-         default:
-            break;
+         PushRelease(context, value);
+         if(!context->releasing) {
+            ProcessReleases(context, context->release_budget);
          }
-         PutFree(context, value);
-         value = next;
-      } else {
+      }
+   }
+}
+
+void PushRelease(JLContext *context, JLValue *value)
+{
+   /* Queued values are removed from the intern table right away so that
+    * parsing cannot hand them out again before they are freed. */
+   if(value->flags & JLFLAG_INTERNED) {
+      RemoveInterned(context, value);
+      value->flags &= ~JLFLAG_INTERNED;
+   }
+   if(context->release_count == context->release_max) {
+      const size_t old_max = context->release_max;
+      const size_t new_max = old_max ? old_max * 2 : 64;
+      JLValue **releases = (JLValue**)ReallocInternal(context,
+                              context->releases, old_max * sizeof(JLValue*),
+                              new_max * sizeof(JLValue*));
+      if(releases == NULL) {
+         /* Out of memory: the value is left for the collector. */
+         value->flags |= JLFLAG_PENDING;
+         return;
+      }
+      context->releases = releases;
+      context->release_max = new_max;
+   }
+   context->releases[context->release_count++] = value;
+}
+
+size_t ProcessReleases(JLContext *context, size_t budget)
+{
+   /* Values to be freed are kept on an explicit stack so that freeing
+    * deeply nested structures does not recurse.  Anything that is
+    * released while processing (including bindings of scopes and
+    * values released by finalizers) is added to the stack.  Static
+    * builtins are shared and never counted, as in JLRelease. */
+   size_t freed = 0;
+   context->releasing = 1;
+   while(context->release_count > 0 && (budget == 0 || freed < budget)) {
+      JLValue *value = context->releases[--context->release_count];
+      JLValue *child = value->next;
+      if(child && !(child->flags & JLFLAG_STATIC)) {
+         child->count -= 1;
+         if(child->count == 0) {
+            PushRelease(context, child);
+         }
+      }
+      switch(value->tag) {
+      case JLVALUE_LIST:
+      case JLVALUE_LAMBDA:
+         child = value->value.lst;
+         if(child && !(child->flags & JLFLAG_STATIC)) {
+            child->count -= 1;
+            if(child->count == 0) {
+               PushRelease(context, child);
+            }
+         }
+         break;
+      case JLVALUE_STRING:
+      case JLVALUE_VARIABLE:
+         FreeString(context, value->value.str);
+         break;
+      case JLVALUE_SCOPE:
+         ReleaseScope(context, (ScopeNode*)value->value.scope);
+         break;
+      case JLVALUE_USERDATA:
+         ReleaseUserData(context, value->value.user);
+         break;
+      case JLVALUE_SPECIAL:
+         PutFree(context, BLOCK_NODE, value->value.special);
+         break;
+      case JLVALUE_NATIVE:
+         PutFree(context, BLOCK_NODE, value->value.native);
+         break;
+      default:
          break;
       }
+      PutFree(context, BLOCK_VALUE, value);
+      freed += 1;
    }
+   context->releasing = 0;
+   return context->release_count;
+}
+
+void JLSetReleaseBudget(JLContext *context, size_t budget)
+{
+   context->release_budget = budget;
+}
+
+char JLCollectStep(JLContext *context, size_t budget)
+{
+   return ProcessReleases(context, budget) > 0;
 }
 
 JLContext *JLCreateContext()
 {
-   JLContext *context = (JLContext*)malloc(sizeof(JLContext));
-   context->scope = NULL;
-   context->freelist = NULL;
-   context->blocks = NULL;
-   context->line = 1;
-   context->levels = 0;
-   context->max_levels = 1 << 15;
-   context->error = 0;
-   JLEnterScope(context);
-   RegisterFunctions(context);
-   JLDefineValue(context, "nil", NULL);
+   return JLCreateContextWithAllocator(NULL, NULL, NULL, NULL);
+}
+
+JLContext *JLCreateContextWithAllocator(JLAllocFunction alloc_func,
+                                        JLReallocFunction realloc_func,
+                                        JLFreeFunction free_func,
+                                        void *arg)
+{
+   JLContext *context = AllocContext(alloc_func, realloc_func,
+                                     free_func, arg);
+   if(context == NULL) {
+      return NULL;
+   }
+   if(!JLEnterScope(context)) {
+      FreeContext(context);
+      return NULL;
+   }
    return context;
 }
 
 void JLDestroyContext(JLContext *context)
 {
-   JLLeaveScope(context);
+   ReleaseModules(context);
+   while(context->scope) {
+      JLLeaveScope(context);
+   }
+   ProcessReleases(context, 0);
+   CollectCycles(context);
+   ProcessReleases(context, 0);
+   FreeRemaining(context);
    FreeContext(context);
 }
 
+void JLSetHashConsing(JLContext *context, char enable)
+{
+   context->hash_cons = enable;
+}
+
 void JLDefineValue(JLContext *context, const char *name, JLValue *value)
 {
    if(name) {
       BindingNode **root = &context->scope->bindings;
+      BindingNode *binding;
       JLRetain(context, value);
       while(*root) {
          const int v = strcmp((*root)->name, name);
@@ -98,11 +206,22 @@ void JLDefineValue(JLContext *context, const char *name, JLValue *value)
       }
 
       /* New binding. */
-      *root = (BindingNode*)GetFree(context);
-      (*root)->name = strdup(name);
-      (*root)->value = value;
-      (*root)->left = NULL;
-      (*root)->right = NULL;
+      binding = (BindingNode*)GetFree(context, BLOCK_BINDING);
+      if(binding) {
+         binding->name = CopyString(context, name);
+         if(binding->name == NULL) {
+            PutFree(context, BLOCK_BINDING, binding);
+            binding = NULL;
+         }
+      }
+      if(binding == NULL) {
+         JLRelease(context, value);
+         return;
+      }
+      binding->value = value;
+      binding->left = NULL;
+      binding->right = NULL;
+      *root = binding;
 
    }
 }
@@ -112,18 +231,228 @@ void JLDefineSpecial(JLContext *context,
                      JLFunction func,
                      void *extra)
 {
-   JLValue *result = CreateValue(context, name, JLVALUE_SPECIAL);
-   result->value.special.func = func;
-   result->value.special.extra = extra;
+   SpecialFunction *special = (SpecialFunction*)GetFree(context, BLOCK_NODE);
+   JLValue *result;
+   if(special == NULL) {
+      return;
+   }
+   result = CreateValue(context, NULL, JLVALUE_SPECIAL);
+   if(result == NULL) {
+      PutFree(context, BLOCK_NODE, special);
+      return;
+   }
+   special->func = func;
+   special->extra = extra;
+   result->value.special = special;
+   JLDefineValue(context, name, result);
    JLRelease(context, result);
 }
 
+void JLDefineNative(JLContext *context,
+                    const char *name,
+                    JLNativeFunction func,
+                    size_t min_args,
+                    size_t max_args,
+                    unsigned int type_mask,
+                    void *extra)
+{
+   NativeFunction *native = (NativeFunction*)GetFree(context, BLOCK_NODE);
+   JLValue *result;
+   if(native == NULL) {
+      return;
+   }
+   result = CreateValue(context, NULL, JLVALUE_NATIVE);
+   if(result == NULL) {
+      PutFree(context, BLOCK_NODE, native);
+      return;
+   }
+   native->func = func;
+   native->extra = extra;
+   native->min_args = min_args > UINT_MAX ? UINT_MAX : (unsigned int)min_args;
+   native->max_args = max_args > UINT_MAX ? UINT_MAX : (unsigned int)max_args;
+   native->types = type_mask;
+   result->value.native = native;
+   JLDefineValue(context, name, result);
+   JLRelease(context, result);
+}
+
+void JLInvalidArgument(JLContext *context)
+{
+   if(context->native_name) {
+      NativeArgumentError(context);
+   } else {
+      Error(context, "invalid argument");
+   }
+}
+
 JLValue *JLDefineNumber(JLContext *context,
                         const char *name,
                         double value)
 {
-   JLValue *result = CreateValue(context, name, JLVALUE_NUMBER);
-   result->value.number = value;
+   JLValue *result;
+
+   /* Small non-negative integers (including the results of predicates)
+    * are shared, so most temporary numbers need no allocation. */
+   if(value >= 0.0 && value < SMALL_NUMBER_COUNT && !signbit(value) &&
+      (double)(int)value == value) {
+      const int index = (int)value;
+      if(context->numbers == NULL) {
+         context->numbers = (JLValue**)AllocMemory(context,
+                                   SMALL_NUMBER_COUNT * sizeof(JLValue*));
+         if(context->numbers == NULL) {
+            return NULL;
+         }
+         memset(context->numbers, 0, SMALL_NUMBER_COUNT * sizeof(JLValue*));
+      }
+      result = context->numbers[index];
+      if(result == NULL) {
+         result = CreateValue(context, NULL, JLVALUE_NUMBER);
+         if(result == NULL) {
+            return NULL;
+         }
+         result->value.number = value;
+         context->numbers[index] = result;
+      }
+      JLRetain(context, result);
+      JLDefineValue(context, name, result);
+      return result;
+   }
+
+   result = CreateValue(context, NULL, JLVALUE_NUMBER);
+   if(result) {
+      result->value.number = value;
+      JLDefineValue(context, name, result);
+   }
+   return result;
+}
+
+JLValue *JLDefineUserData(JLContext *context,
+                          const char *name,
+                          const struct JLUserType *type,
+                          void *data)
+{
+   UserData *user = (UserData*)GetFree(context, BLOCK_NODE);
+   JLValue *result = user ? CreateValue(context, NULL, JLVALUE_USERDATA)
+                          : NULL;
+   if(result == NULL) {
+      /* The value owns the data, so it is finalized if the value
+       * cannot be made. */
+      if(user) {
+         PutFree(context, BLOCK_NODE, user);
+      }
+      if(type->finalize) {
+         (type->finalize)(context, data);
+      }
+      return NULL;
+   }
+   user->data = data;
+   user->type = type;
+   user->count = 1;
+   result->value.user = user;
+   JLDefineValue(context, name, result);
+   return result;
+}
+
+JLValue *JLDefineString(JLContext *context,
+                        const char *name,
+                        const char *str,
+                        size_t len)
+{
+   char *data;
+   JLValue *result = JLDefineStringBuffer(context, name, len, &data);
+   if(result) {
+      memcpy(data, str, len);
+   }
+   return result;
+}
+
+JLValue *JLDefineStringBuffer(JLContext *context,
+                              const char *name,
+                              size_t len,
+                              char **data)
+{
+   char *str = AllocString(context, len + 1);
+   JLValue *result = str ? CreateValue(context, NULL, JLVALUE_STRING) : NULL;
+   *data = NULL;
+   if(result == NULL) {
+      FreeString(context, str);
+      return NULL;
+   }
+   str[len] = 0;
+   result->value.str = str;
+   *data = str;
+   JLDefineValue(context, name, result);
+   return result;
+}
+
+JLValue *JLDefineList(JLContext *context,
+                      const char *name,
+                      size_t count,
+                      JLValue **items)
+{
+   /* An item can be linked in place if the caller holds the only
+    * reference, since nothing else can see its next pointer.  Builtins
+    * are always copied. */
+   JLValue *result = NULL;
+   JLValue **tail;
+   size_t i;
+
+   if(count == 0) {
+      JLDefineValue(context, name, NULL);
+      return NULL;
+   }
+   result = CreateValue(context, NULL, JLVALUE_LIST);
+   tail = result ? &result->value.lst : NULL;
+   for(i = 0; i < count; i++) {
+      JLValue *item = items[i];
+      if(tail == NULL) {
+         /* Out of memory: the remaining items are still released. */
+         JLRelease(context, item);
+      } else if(item == NULL || item->count != 1 || item->next != NULL ||
+                (item->flags & (JLFLAG_INTERNED | JLFLAG_STATIC))) {
+         *tail = CopyValue(context, item);
+         JLRelease(context, item);
+      } else {
+         *tail = item;
+      }
+      tail = (tail && *tail) ? &(*tail)->next : NULL;
+   }
+   if(tail == NULL) {
+      JLRelease(context, result);
+      return NULL;
+   }
+   JLDefineValue(context, name, result);
+   return result;
+}
+
+JLValue *JLDefineNumberList(JLContext *context,
+                            const char *name,
+                            size_t count,
+                            const double *values)
+{
+   JLValue *result = NULL;
+   JLValue **tail;
+   size_t i;
+
+   if(count == 0) {
+      JLDefineValue(context, name, NULL);
+      return NULL;
+   }
+   result = CreateValue(context, NULL, JLVALUE_LIST);
+   if(result == NULL) {
+      return NULL;
+   }
+   tail = &result->value.lst;
+   for(i = 0; i < count; i++) {
+      *tail = CreateValue(context, NULL, JLVALUE_NUMBER);
+      if(*tail == NULL) {
+         JLRelease(context, result);
+         return NULL;
+      }
+      (*tail)->value.number = values[i];
+      tail = &(*tail)->next;
+   }
+   JLDefineValue(context, name, result);
    return result;
 }
 
@@ -131,7 +460,11 @@ JLValue *JLEvaluate(JLContext *context, JLValue *value)
 {
    JLValue *result = NULL;
    if(context->levels == 0) {
+      /* Safe point: continue freeing anything deferred. */
       context->error = 0;
+      if(context->release_count > 0) {
+         ProcessReleases(context, context->release_budget);
+      }
    } else if(context->error) {
       return NULL;
    }
@@ -146,8 +479,11 @@ JLValue *JLEvaluate(JLContext *context, JLValue *value)
       if(temp) {
          switch(temp->tag) {
          case JLVALUE_SPECIAL:
-            result = (temp->value.special.func)(context, value->value.lst,
-                                                temp->value.special.extra);
+            result = (temp->value.special->func)(context, value->value.lst,
+                                                 temp->value.special->extra);
+            break;
+         case JLVALUE_NATIVE:
+            result = EvalNative(context, temp, value->value.lst);
             break;
          case JLVALUE_LAMBDA:
             result = EvalLambda(context, temp, value->value.lst);
@@ -166,6 +502,9 @@ JLValue *JLEvaluate(JLContext *context, JLValue *value)
       JLRetain(context, result);
    }
    context->levels -= 1;
+   if(context->levels == 0) {
+      ReclaimBlocks(context, 0);
+   }
    return result;
 }
 
@@ -188,12 +527,7 @@ JLValue *EvalLambda(JLContext *context, const JLValue *lambda, JLValue *args)
     * args should be a list of arguments that is the same length as
     * the number of parameters to the lambda. */
 
-   /* Make sure the lambda is well-defined. */
-   if(lambda->value.lst == NULL ||
-      lambda->value.lst->tag != JLVALUE_SCOPE ||
-      lambda->value.lst->next == NULL ||
-      lambda->value.lst->next->tag != JLVALUE_LIST) {
-      Error(context, "invalid lambda");
+   if(!CheckLambda(context, lambda)) {
       return NULL;
    }
    scope = lambda->value.lst;
@@ -203,7 +537,10 @@ JLValue *EvalLambda(JLContext *context, const JLValue *lambda, JLValue *args)
    /* Insert bindings. */
    old_scope = context->scope;
    context->scope = (ScopeNode*)scope->value.scope;
-   JLEnterScope(context);
+   if(!JLEnterScope(context)) {
+      context->scope = old_scope;
+      return NULL;
+   }
    new_scope = context->scope;
    bp = params;
    ap = args->next;  /* Skip the name */
@@ -221,14 +558,25 @@ JLValue *EvalLambda(JLContext *context, const JLValue *lambda, JLValue *args)
       context->scope = old_scope;
       if(bp->next == NULL && ap->next != NULL) {
 
-         /* Make the rest of the arguments into a list parameter. */
+         /* Make the rest of the arguments into a list parameter.
+          * The arguments are copied since evaluated values may be
+          * shared. */
+         JLValue **item;
          result = CreateValue(context, NULL, JLVALUE_LIST);
-         JLValue **item = &result->value.lst;
-         while(ap) {
-            *item = JLEvaluate(context, ap);
-            item = &(*item)->next;
+         item = result ? &result->value.lst : NULL;
+         while(ap && item) {
+            JLValue *arg = JLEvaluate(context, ap);
+            *item = CopyValue(context, arg);
+            item = *item ? &(*item)->next : NULL;
+            JLRelease(context, arg);
             ap = ap->next;
          }
+         if(item == NULL) {
+            context->scope = new_scope;
+            JLRelease(context, result);
+            result = NULL;
+            goto done_eval_lambda;
+         }
 
       } else {
 
@@ -244,14 +592,7 @@ JLValue *EvalLambda(JLContext *context, const JLValue *lambda, JLValue *args)
       bp = bp->next;
    }
 
-   result = NULL;
-   while(code) {
-      result = JLEvaluate(context, code);
-      code = code->next;
-      if(code) {
-         JLRelease(context, result);
-      }
-   }
+   result = EvalBody(context, code);
 
 done_eval_lambda:
 
@@ -262,223 +603,292 @@ done_eval_lambda:
 
 }
 
-JLValue *ParseLiteral(JLContext *context, const char **line)
+JLValue *EvalNative(JLContext *context, const JLValue *native,
+                    JLValue *args)
 {
+   /* The arguments are evaluated into an array that is on the stack
+    * unless there are many of them.  The name is only used for errors. */
+   const NativeFunction *func = native->value.native;
+   const char *name = args->tag == JLVALUE_VARIABLE
+                    ? args->value.str : "function";
+   const char *outer_name;
+   JLValue *local[NATIVE_STACK_ARGS];
+   JLValue **argv = local;
+   JLValue *result = NULL;
+   JLValue *ap;
+   size_t argc = 0;
+   size_t i;
 
-   /* Separators include '(', ')', and white-space.
-    * If if token starts with '"', we treat it as a string with escape
-    * characters like in C.
-    * Otherwise, if a token can be parsed as a number, we treat it as such.
-    * Everything else we treat as a string.
-    * Note that function lookups happen later, here we only generate
-    * strings and floating-point numbers.
-    */
-
-   JLValue *result = CreateValue(context, NULL, JLVALUE_NIL);
-
-   if(**line == '\"') {
-      size_t max_len = 16;
-      size_t len = 0;
-      char in_control = 0;
-      char in_hex = 0;
-      char in_octal = 0;
-      result->value.str = (char*)malloc(max_len);
-      *line += 1;
-      while(**line && (in_control != 0 || **line != '\"')) {
-         if(len + 1 >= max_len) {
-            max_len += 16;
-            result->value.str = (char*)realloc(result->value.str, max_len);
-         }
-         if(in_hex) {
-            /* In a hex control sequence. */
-            if(**line >= '0' && **line <= '9') {
-               result->value.str[len] *= 16;
-               result->value.str[len] += **line - '0';
-               in_hex -= 1;
-               *line += 1;
-            } else if(**line >= 'a' && **line <= 'f') {
-               result->value.str[len] *= 16;
-               result->value.str[len] += **line - 'a' + 10;
-               in_hex -= 1;
-               *line += 1;
-            } else if(**line >= 'A' && **line <= 'F') {
-               result->value.str[len] *= 16;
-               result->value.str[len] += **line - 'A' + 10;
-               in_hex -= 1;
-               *line += 1;
-            } else {
-               /* Premature end of hex sequence; reparse this character. */
-               in_hex = 0;
-            }
-         } else if(in_octal) {
-            /* In an octal control sequence. */
-            if(**line >= '0' && **line <= '7') {
-               result->value.str[len] *= 8;
-               result->value.str[len] += **line - '0';
-               in_octal -= 1;
-               *line += 1;
-            } else {
-               /* Premature end of octal sequence; reparse this character. */
-               in_octal = 0;
-            }
-         } else if(in_control) {
-            /* In a control sequence. */
-            in_control = 0;
-            switch(**line) {
-            case 'a':   /* bell */
-               result->value.str[len++] = '\a';
-               break;
-            case 'b':   /* backspace */
-               result->value.str[len++] = '\b';
-               break;
-            case 'f':   /* form-feed */
-               result->value.str[len++] = '\f';
-               break;
-            case 'n':   /* new-line */
-               result->value.str[len++] = '\n';
-               break;
-            case 'r':   /* carriage return */
-               result->value.str[len++] = '\r';
-               break;
-            case 't':   /* tab */
-               result->value.str[len++] = '\t';
-               break;
-            case 'v':   /* vertical tab */
-               result->value.str[len++] = '\v';
-               break;
-            case 'x':   /* Hex control sequence. */
-               in_hex = 2;
-               break;
-            case '0':   /* Octal control sequence. */
-               in_octal = 3;
-               break;
-            default:    /* Literal character */
-               result->value.str[len++] = **line;
-               break;
-            }
-            *line += 1;
-         } else if(**line == '\\') {
-            /* Start of a control sequence. */
-            in_control = 1;
-            *line += 1;
-         } else {
-            /* Regular character. */
-            result->value.str[len] = **line;
-            len += 1;
-            *line += 1;
-         }
-      }
-      result->value.str[len] = 0;
-      result->tag = JLVALUE_STRING;
-      if(**line) {
-         /* Skip the terminating '"'. */
-         *line += 1;
-      }
-   } else {
-
-      const char *start = *line;
-      char *end;
-      size_t len = 0;
-
-      /* Determine how long this token is. */
-      while(**line != 0 && **line != '(' && **line != ')' &&
-            **line != ' ' && **line != '\t' && **line != '\r' &&
-            **line != '\n' && **line != ';') {
-         len += 1;
-         *line += 1;
+   for(ap = args->next; ap; ap = ap->next) {
+      argc += 1;
+   }
+   if(argc < func->min_args) {
+      Error(context, "too few arguments to %s", name);
+      return NULL;
+   }
+   if(argc > func->max_args) {
+      Error(context, "too many arguments to %s", name);
+      return NULL;
+   }
+   if(argc > NATIVE_STACK_ARGS) {
+      argv = (JLValue**)AllocMemory(context, argc * sizeof(JLValue*));
+      if(argv == NULL) {
+         return NULL;
       }
+   }
 
-      /* Attempt to parse the token as a double. */
-      result->value.number = strtod(start, &end);
-
-      /* If we couldn't parse the whole thing, treat it as a variable. */
-      if(start + len != end) {
-         result->tag = JLVALUE_VARIABLE;
-         result->value.str = (char*)malloc(len + 1);
-         memcpy(result->value.str, start, len);
-         result->value.str[len] = 0;
-      } else {
-         result->tag = JLVALUE_NUMBER;
+   for(i = 0, ap = args->next; ap; i++, ap = ap->next) {
+      argv[i] = JLEvaluate(context, ap);
+      if(!(func->types & TYPE_BIT(argv[i] ? argv[i]->tag : JLVALUE_NIL))
+         && !context->error) {
+         Error(context, "invalid argument to %s", name);
       }
+   }
 
+   if(!context->error) {
+      outer_name = context->native_name;
+      context->native_name = name;
+      result = (func->func)(context, argc, argv, func->extra);
+      context->native_name = outer_name;
    }
 
+   for(i = 0; i < argc; i++) {
+      JLRelease(context, argv[i]);
+   }
+   if(argv != local) {
+      FreeMemory(context, argv, argc * sizeof(JLValue*));
+   }
    return result;
-
 }
 
-JLValue *ParseList(JLContext *context, const char **line)
+char CheckLambda(JLContext *context, const JLValue *lambda)
 {
+   /* Make sure the lambda is well-defined. */
+   if(lambda == NULL || lambda->tag != JLVALUE_LAMBDA ||
+      lambda->value.lst == NULL ||
+      lambda->value.lst->tag != JLVALUE_SCOPE ||
+      lambda->value.lst->next == NULL ||
+      lambda->value.lst->next->tag != JLVALUE_LIST) {
+      Error(context, "invalid lambda");
+      return 0;
+   }
+   return 1;
+}
 
-   JLValue *result;
-   JLValue **item;
-
-   *line += 1;    /* Skip '(' */
+JLValue *EvalBody(JLContext *context, JLValue *code)
+{
+   /* Evaluate each expression, returning the value of the last. */
+   JLValue *result = NULL;
+   while(code) {
+      result = JLEvaluate(context, code);
+      code = code->next;
+      if(code) {
+         JLRelease(context, result);
+      }
+   }
+   return result;
+}
 
-   result = CreateValue(context, NULL, JLVALUE_LIST);
-   result->value.lst = NULL;
-   item = &result->value.lst;
+JLValue *JLCall(JLContext *context, JLValue *lambda,
+                size_t argc, JLValue **argv)
+{
+   /* The same as EvalLambda, except that the arguments are values to be
+    * bound directly rather than expressions to evaluate. */
+   ScopeNode *old_scope;
+   JLValue *bp;
+   JLValue *result = NULL;
+   size_t i = 0;
 
-   while(**line && **line != ')') {
-      JLValue *temp = ParseExpression(context, line);
-      if(temp == NULL) {
-         break;
+   if(context->levels == 0) {
+      context->error = 0;
+      if(context->release_count > 0) {
+         ProcessReleases(context, context->release_budget);
       }
-      *item = temp;
-      item = &(*item)->next;
+   } else if(context->error) {
+      return NULL;
    }
-
-   if(**line != ')') {
-      Error(context, "expected ')'");
-      JLRelease(context, result);
+   if(!CheckLambda(context, lambda)) {
       return NULL;
    }
+   if(context->levels >= context->max_levels) {
+      Error(context, "maximum evaluation depth exceeded");
+      return NULL;
+   }
+   context->levels += 1;
 
-   *line += 1;    /* Skip ')' */
+   old_scope = context->scope;
+   context->scope = (ScopeNode*)lambda->value.lst->value.scope;
+   if(!JLEnterScope(context)) {
+      context->scope = old_scope;
+      context->levels -= 1;
+      return NULL;
+   }
+   for(bp = lambda->value.lst->next->value.lst; bp; bp = bp->next) {
+      if(i >= argc) {
+         Error(context, "too few arguments");
+         break;
+      }
+      if(bp->tag != JLVALUE_VARIABLE) {
+         Error(context, "invalid lambda argument");
+         break;
+      }
+      if(bp->next == NULL && argc - i > 1) {
+         /* Make the rest of the arguments into a list parameter. */
+         JLValue *rest = CreateValue(context, NULL, JLVALUE_LIST);
+         JLValue **item = rest ? &rest->value.lst : NULL;
+         while(i < argc && item) {
+            *item = CopyValue(context, argv[i]);
+            item = *item ? &(*item)->next : NULL;
+            i += 1;
+         }
+         if(item == NULL) {
+            JLRelease(context, rest);
+            break;
+         }
+         JLDefineValue(context, bp->value.str, rest);
+         JLRelease(context, rest);
+      } else {
+         JLDefineValue(context, bp->value.str, argv[i]);
+         i += 1;
+      }
+   }
+   if(!context->error) {
+      result = EvalBody(context, lambda->value.lst->next->next);
+   }
+   JLLeaveScope(context);
+   context->scope = old_scope;
 
+   context->levels -= 1;
+   if(context->levels == 0) {
+      ReclaimBlocks(context, 0);
+   }
    return result;
+}
 
+char Peek(const JLContext *context, const char **line)
+{
+   if(context->parse_end && *line >= context->parse_end) {
+      return 0;
+   }
+   return **line;
 }
 
 JLValue *ParseExpression(JLContext *context, const char **line)
 {
-   /* Skip leading white-space. */
+
+   /* Lists are parsed with an explicit stack holding the end of each
+    * open list, so the nesting depth is limited only by max_nesting.
+    * Each list is linked to its parent when opened, so releasing the
+    * outermost list releases everything on an error.  The stack is
+    * kept in the context for the next parse. */
+
+   JLValue ***tails = context->parse_stack;
+   JLValue *root = NULL;
+   size_t depth = 0;
+
    for(;;) {
-      if(**line == ';') {
-         while(**line && **line != '\n') {
-            *line += 1;
+      JLValue *item;
+      char ch;
+      *line = SkipSpace(context, *line);
+      ch = Peek(context, line);
+      if(ch == ')' && depth > 0) {
+         *line += 1;
+         depth -= 1;
+         if(depth == 0) {
+            break;
+         }
+         continue;
+      } else if(ch == 0 || ch == ')') {
+         if(depth > 0) {
+            Error(context, "expected ')'");
          }
-      } else if(**line == '\n') {
-         context->line += 1;
-      } else if(  **line != '\t' &&
-                  **line != ' ' &&
-                  **line != '\r') {
          break;
+      } else if(ch == '(') {
+         if(context->max_nesting > 0 && depth >= context->max_nesting) {
+            Error(context, "maximum nesting depth exceeded");
+            break;
+         }
+         *line += 1;
+         item = CreateValue(context, NULL, JLVALUE_LIST);
+      } else {
+         item = ParseLiteral(context, line);
       }
-      *line += 1;
+      if(item == NULL) {
+         break;
+      }
+
+      if(depth == 0) {
+         root = item;
+      } else {
+         *tails[depth - 1] = item;
+         tails[depth - 1] = &item->next;
+      }
+      if(context->error) {
+         break;
+      } else if(item->tag != JLVALUE_LIST) {
+         if(depth == 0) {
+            break;
+         }
+         continue;
+      }
+
+      if(depth == context->parse_stack_size) {
+         const size_t old_size = context->parse_stack_size;
+         const size_t new_size = old_size ? old_size * 2 : 16;
+         tails = (JLValue***)ReallocMemory(context, context->parse_stack,
+                              old_size * sizeof(JLValue**),
+                              new_size * sizeof(JLValue**));
+         if(tails == NULL) {
+            break;
+         }
+         context->parse_stack = tails;
+         context->parse_stack_size = new_size;
+      }
+      tails[depth] = &item->value.lst;
+      depth += 1;
    }
 
-   switch(**line) {
-   case 0:
-   case ')':
+   if(context->error) {
+      JLRelease(context, root);
       return NULL;
-   case '(':
-      return ParseList(context, line);
-   default:
-      return ParseLiteral(context, line);
    }
+   return root;
+
 }
 
-JLValue *JLParse(JLContext *context, const char **line)
+JLValue *ParseBounded(JLContext *context, const char **line,
+                      const char *end)
 {
-   JLValue *result = ParseExpression(context, line);
-   if(**line == ')') {
+   JLValue *result;
+   context->error = 0;
+   context->parse_end = end;
+   result = ParseExpression(context, line);
+   if(Peek(context, line) == ')') {
       Error(context, "unexpected ')'");
       *line += 1;
    }
+   context->parse_end = NULL;
+   if(context->hash_cons) {
+      result = InternTree(context, result);
+   }
    return result;
 }
 
+void JLSetNestingLimit(JLContext *context, size_t limit)
+{
+   context->max_nesting = limit;
+}
+
+JLValue *JLParse(JLContext *context, const char **line)
+{
+   return ParseBounded(context, line, NULL);
+}
+
+JLValue *JLParseN(JLContext *context, const char **line, size_t len)
+{
+   return ParseBounded(context, line, *line + len);
+}
+
 char JLIsNumber(JLValue *value)
 {
    if(value && value->tag == JLVALUE_NUMBER) {
@@ -526,50 +936,18 @@ JLValue *JLGetNext(JLValue *value)
    return value->next;
 }
 
-void JLPrint(const JLContext *context, const JLValue *value)
+char JLIsUserData(JLValue *value, const struct JLUserType *type)
 {
-   JLValue *temp;
-   if(value == NULL || value->tag == JLVALUE_NIL) {
-      printf("nil");
-      return;
-   }
-   switch(value->tag) {
-   case JLVALUE_NUMBER:
-      printf("%g", value->value.number);
-      break;
-   case JLVALUE_STRING:
-      printf("\"%s\"", value->value.str);
-      break;
-   case JLVALUE_LIST:
-      printf("(");
-      for(temp = value->value.lst; temp; temp = temp->next) {
-         JLPrint(context, temp);
-         if(temp->next) {
-            printf(" ");
-         }
-      }
-      printf(")");
-      break;
-   case JLVALUE_LAMBDA:
-      printf("(lambda ");
-      for(temp = value->value.lst->next; temp; temp = temp->next) {
-         JLPrint(context, temp);
-         if(temp->next) {
-            printf(" ");
-         }
-      }
-      printf(")");
-      break;
-   case JLVALUE_SPECIAL:
-      printf("special@%p(%p)", value->value.special.func,
-             value->value.special.extra);
-      break;
-   case JLVALUE_VARIABLE:
-      printf("%s", value->value.str);
-      break;
-   default:
-      printf("\n?\n");
-      break;
+   if(value && value->tag == JLVALUE_USERDATA &&
+      value->value.user->type == type) {
+      return 1;
+   } else {
+      return 0;
    }
 }
 
+void *JLGetUserData(JLValue *value)
+{
+   return value->value.user->data;
+}
+
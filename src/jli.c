@@ -10,39 +10,24 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static struct JLValue *PrintFunc(struct JLContext *context,
-                                 struct JLValue *args,
+                                 size_t argc,
+                                 struct JLValue **argv,
                                  void *extra)
 {
-   struct JLValue *vp;
-   for(vp = JLGetNext(args); vp; vp = JLGetNext(vp)) {
-      struct JLValue *result = JLEvaluate(context, vp);
-      if(JLIsString(result)) {
-         printf("%s", JLGetString(result));
+   size_t i;
+   for(i = 0; i < argc; i++) {
+      if(JLIsString(argv[i])) {
+         fputs(JLGetString(argv[i]), stdout);
       } else {
-         JLPrint(context, result);
+         JLPrintToFile(context, argv[i], stdout);
       }
-      JLRelease(context, result);
    }
    return NULL;
 }
 
-static struct JLValue *ProcessBuffer(struct JLContext *context,
-                                     const char *line)
-{
-   struct JLValue *result = NULL;
-   while(*line) {
-      struct JLValue *value = JLParse(context, &line);
-      if(value) {
-         JLRelease(context, result);
-         result = JLEvaluate(context, value);
-         JLRelease(context, value);
-      }
-   }
-   return result;
-}
-
 int main(int argc, char *argv[])
 {
    struct JLContext *context;
@@ -50,11 +35,16 @@ int main(int argc, char *argv[])
    char *line = NULL;
    size_t cap = 0;
    char *filename = NULL;
+   char use_cache = 0;
+   int status = 0;
 
-   if(argc == 2) {
+   if(argc == 3 && !strcmp(argv[1], "-c")) {
+      filename = argv[2];
+      use_cache = 1;
+   } else if(argc == 2) {
       filename = argv[1];
    } else if(argc != 1) {
-      printf("usage: %s <file>\n", argv[0]);
+      printf("usage: %s [-c] <file>\n", argv[0]);
       return -1;
    } else {
       printf("JL Interpreter v%d.%d\n", JL_VERSION_MAJOR, JL_VERSION_MINOR);
@@ -62,45 +52,57 @@ int main(int argc, char *argv[])
    }
 
    context = JLCreateContext();
-   JLDefineSpecial(context, "print", PrintFunc, NULL);
+   if(context == NULL) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+   JLDefineNative(context, "print", PrintFunc, 0, JLARGS_UNLIMITED,
+                  JLTYPE_ANY, NULL);
 
-   if(filename) {
+   if(use_cache) {
+      struct JLValue *code = JLParseCachedFile(context, filename);
+      struct JLValue *value;
+      if(code == NULL) {
+         /* The error was reported when the file was parsed. */
+         status = -1;
+      } else {
+         for(value = JLGetHead(code); value; value = JLGetNext(value)) {
+            result = JLEvaluate(context, value);
+            JLRelease(context, result);
+         }
+         JLRelease(context, code);
+      }
+   } else if(filename) {
       FILE *fd = fopen(filename, "r");
-      size_t len = 0;
-      size_t max_len = 16;
-      if(!fd) {
+      if(fd) {
+         fclose(fd);
+         result = JLEvaluateFile(context, filename);
+         JLRelease(context, result);
+      } else {
          printf("ERROR: file \"%s\" not found\n", filename);
-         return -1;
+         status = -1;
       }
-      line = (char*)malloc(max_len);
-      for(;;) {
-         const int ch = fgetc(fd);
-         if(ch == EOF) {
-            line[len] = 0;
-            break;
-         }
-         if(len >= max_len) {
-            max_len *= 2;
-            line = (char*)realloc(line, max_len);
-         }
-         line[len] = (char)ch;
-         len += 1;
-      }
-      fclose(fd);
-      result = ProcessBuffer(context, line);
-      JLRelease(context, result);
    } else {
-      for(;;) {
+      struct JLParser *parser = JLCreateParser(context);
+      while(parser) {
+         struct JLValue *value;
          printf("> "); fflush(stdout);
          const ssize_t len = getline(&line, &cap, stdin);
+         JLParserFeed(parser, line, len > 0 ? len : 0);
+         while((value = JLParserNext(parser)) != NULL) {
+            result = JLEvaluate(context, value);
+            JLRelease(context, value);
+            printf("=> ");
+            JLPrint(context, result);
+            printf("\n");
+            JLRelease(context, result);
+         }
          if(len <= 0) {
             break;
          }
-         result = ProcessBuffer(context, line);
-         printf("=> ");
-         JLPrint(context, result);
-         printf("\n");
-         JLRelease(context, result);
+      }
+      if(parser) {
+         JLDestroyParser(parser);
       }
    }
    if(line) {
@@ -108,7 +110,7 @@ int main(int argc, char *argv[])
    }
    JLDestroyContext(context);
 
-   return 0;
+   return status;
 
 }
 